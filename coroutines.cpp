@@ -1,9 +1,69 @@
 // autor:       Jakub Ostrzołek
 // opis:        zadanie dodatkowe ZPR - C++20 coroutines
-// kompilacja:  g++ -fcoroutines -std=c++20 coroutines.cpp
+// kompilacja:  g++ -fcoroutines -std=c++20 -O2 -pthread coroutines.cpp
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
 #include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <source_location>
+#include <sstream>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 // Coroutine to koncepcja znana z innych języków, takich jak JavaScript, Kotlin,
 // Go i innych. Jest to funkcja, która potrafi zapamiętać swój stan na stercie i
@@ -235,29 +295,178 @@ namespace p3 {
 //
 // Poniższy szablon został wzorowany na przykładzie z dokumentacji:
 // https://en.cppreference.com/w/cpp/language/coroutines#co_yield
-template <typename T> struct Generator {
+//
+// Parametr Frame to klasa bazowa promise_type. Jeżeli definiuje ona statyczne
+// operator new/delete, to właśnie one zostaną użyte do alokacji ramki
+// coroutine (przykład p9). Domyślnie ramka trafia na stertę przez globalny
+// operator new.
+//
+// Frame może też obserwować coroutine (przykład p13): jeżeli da się ją
+// skonstruować ze std::source_location, dostaje miejsce utworzenia ramki, a
+// jeżeli ma metody on_resume() i on_suspend(), są one wołane wokół każdego
+// wznowienia w Generator<...>::fill().
+struct heap_frame {};
+
+// Parametr Start decyduje, kiedy coroutine zaczyna działać (porównaj
+// initial_suspend() w p1 i p2):
+// * lazy_start - dopiero przy pierwszym odczycie (jak w p1),
+// * eager_start<K> - od razu przy utworzeniu, aż do wygenerowania K wartości
+//   (jak w p2). Pierwsza wartość jest więc gotowa bez dodatkowego wznowienia,
+//   a przy K > 1 kolejne K - 1 wartości czekają w buforze w promise.
+struct lazy_start {
+  static constexpr std::size_t run_ahead = 0;
+};
+template <std::size_t K = 1> struct eager_start {
+  static_assert(K >= 1);
+  static constexpr std::size_t run_ahead = K;
+};
+
+// Parametr Checks decyduje o kontrolach wykonywanych przy każdym odczycie:
+// * checked - opisane niżej zabezpieczenie stanem full_ oraz propagacja
+//   wyjątków przez exception_. W wersji debug (bez NDEBUG) dodatkowo asercje
+//   wykrywające użycie przeniesionego generatora, odczyt po zakończeniu i
+//   wznowienie zakończonej coroutine,
+// * unchecked - operator bool to samo wznowienie, a operator() samo
+//   odczytanie wartości. Wywołania muszą ściśle naprzemiennie występować
+//   (`while (gen) use(gen());`), a wyjątek wydostaje się bezpośrednio z
+//   wznowienia, więc promise nie przechowuje std::exception_ptr.
+struct checked {
+  static constexpr bool enabled = true;
+};
+struct unchecked {
+  static constexpr bool enabled = false;
+};
+
+// Parametr Seek decyduje, czy coroutine potrafi przeskakiwać wartości
+// (przykład p18):
+// * sequential - advance(n) wznawia coroutine n razy, a `co_yield` to samo
+//   zawieszenie, bez dodatkowego pola w promise,
+// * seekable - wynikiem `std::size_t skip = co_yield value;` jest liczba
+//   wartości, które konsument chce pominąć, więc advance(n) wymaga jednego
+//   wznowienia.
+struct sequential {
+  static constexpr bool enabled = false;
+};
+struct seekable {
+  static constexpr bool enabled = true;
+};
+
+template <typename T, typename Frame = heap_frame, typename Start = lazy_start,
+          typename Checks = checked, typename Seek = sequential>
+struct Generator
+    : std::ranges::view_interface<Generator<T, Frame, Start, Checks, Seek>> {
+  static_assert(Checks::enabled || Start::run_ahead == 0,
+                "eager_start requires checked reads");
+
   struct promise_type;
   using handle_type = std::coroutine_handle<promise_type>;
 
-  struct promise_type {
+  // Liczba wartości buforowanych w promise poza promise_type::value_.
+  static constexpr std::size_t ahead =
+      Start::run_ahead > 1 ? Start::run_ahead - 1 : 0;
+
+  // W odróżnieniu od std::generator (gdzie reference to T &&) element jest
+  // zwracany jako lvalue wartości w promise, więc działa `for (auto &v : gen)`.
+  using value_type = T;
+  using reference = T &;
+
+  struct promise_type : Frame {
+    struct no_exception {};
+
     T value_;
-    std::exception_ptr exception_;
+    [[no_unique_address]] std::conditional_t<Checks::enabled,
+                                             std::exception_ptr, no_exception>
+        exception_;
+
+    // Bufor wartości wygenerowanych z wyprzedzeniem przy utworzeniu.
+    struct run_ahead_buffer {
+      std::array<T, ahead> values_;
+      std::size_t count_ = 0;
+      std::size_t pos_ = 0;
+    };
+    struct no_buffer {};
+    [[no_unique_address]] std::conditional_t<(ahead > 0), run_ahead_buffer,
+                                             no_buffer> buffer_;
+
+    promise_type()
+      requires std::default_initializable<Frame>
+    = default;
+    // Domyślny argument std::source_location::current() w konstruktorze
+    // promise wskazuje na funkcję coroutine, która go tworzy.
+    promise_type(std::source_location site = std::source_location::current())
+      requires(!std::default_initializable<Frame> &&
+               std::constructible_from<Frame, std::source_location>)
+        : Frame(site) {}
 
     Generator get_return_object() { return {handle_type::from_promise(*this)}; }
-    std::suspend_always initial_suspend() { return {}; }
+    auto initial_suspend() {
+      if constexpr (Start::run_ahead == 0)
+        return std::suspend_always{};
+      else
+        return std::suspend_never{};
+    }
     std::suspend_always final_suspend() noexcept { return {}; }
 
     // Zapamiętujemy wyjątek, aby rzucić go później w funkcji
     // Generator<...>::fill(). W ten sposób wyjątek przepropaguje do kodu
     // wołającego coroutine.
-    void unhandled_exception() { exception_ = std::current_exception(); }
+    void unhandled_exception() {
+      if constexpr (Checks::enabled)
+        exception_ = std::current_exception();
+      else
+        throw;
+    }
+
+    // Liczba wartości do pominięcia przy następnym wznowieniu (tylko przy
+    // Seek = seekable).
+    struct no_skip {};
+    [[no_unique_address]] std::conditional_t<Seek::enabled, std::size_t,
+                                             no_skip> skip_{};
+
+    // Przy seekable wynikiem `co_yield expr` jest liczba wartości, które
+    // konsument chce pominąć (Generator<...>::advance()).
+    struct seek_awaiter : std::suspend_always {
+      promise_type *p_;
+      bool ready_;
+      bool await_ready() const noexcept { return ready_; }
+      std::size_t await_resume() const noexcept {
+        return std::exchange(p_->skip_, 0);
+      }
+    };
+    // Przy eager_start<K> pierwsze K - 1 wartości trafia do bufora bez
+    // zawieszania coroutine.
+    struct run_ahead_awaiter : std::suspend_always {
+      bool ready_;
+      bool await_ready() const noexcept { return ready_; }
+    };
+    using yield_awaiter = std::conditional_t<
+        Seek::enabled, seek_awaiter,
+        std::conditional_t<(ahead > 0), run_ahead_awaiter,
+                           std::suspend_always>>;
+
+    yield_awaiter make_yield_awaiter([[maybe_unused]] bool ready) {
+      if constexpr (Seek::enabled)
+        return {{}, this, ready};
+      else if constexpr (ahead > 0)
+        return {{}, ready};
+      else
+        return {};
+    }
 
     // Korzystamy z konceptów c++20, aby można było wywołać co_yield z
     // jakąkolwiek wartością konwertowalną do oczekiwanej wartości.
     template <std::convertible_to<T> From>
-    std::suspend_always yield_value(From &&from) {
+    yield_awaiter yield_value(From &&from) {
+      if constexpr (ahead > 0) {
+        // Dopóki bufor nie jest pełny, zapisujemy do niego i nie zawieszamy
+        // coroutine. Bufor zapełnia się tylko raz - przy utworzeniu.
+        if (buffer_.count_ < ahead) {
+          buffer_.values_[buffer_.count_++] = std::forward<From>(from);
+          return make_yield_awaiter(true);
+        }
+      }
       value_ = std::forward<From>(from);
-      return {};
+      return make_yield_awaiter(false);
     }
     void return_void() {}
   };
@@ -267,8 +476,29 @@ template <typename T> struct Generator {
   handle_type h_;
 
   Generator(handle_type h) : h_(h) {}
+
+  // Generator jest jedynym właścicielem ramki coroutine, więc nie może być
+  // kopiowany (podwójne h_.destroy()). Przy przenoszeniu zerujemy uchwyt w
+  // obiekcie źródłowym, co pozwala m.in. trzymać generatory w std::vector.
+  Generator(const Generator &) = delete;
+  Generator &operator=(const Generator &) = delete;
+  Generator(Generator &&other) noexcept
+      : h_(std::exchange(other.h_, {})), full_(other.full_) {}
+  Generator &operator=(Generator &&other) noexcept {
+    if (this != &other) {
+      if (h_)
+        h_.destroy();
+      h_ = std::exchange(other.h_, {});
+      full_ = other.full_;
+    }
+    return *this;
+  }
+
   // Zwalniamy pamięć zaalokowaną na stercie
-  ~Generator() { h_.destroy(); }
+  ~Generator() {
+    if (h_)
+      h_.destroy();
+  }
 
   // Tutaj Generator<...>::operator bool sprawdza czy coroutine zakończyła
   // działanie.
@@ -278,18 +508,84 @@ template <typename T> struct Generator {
   // zostanie zapamiętany w promise_type::value_, a h_.done() == false. W
   // przeciwnym wypadku pole promise_type::value_ pozostanie niezmienione, a
   // h_.done() == true.
+  //
+  // Przy eager_start<K> wartości z bufora są dostępne również wtedy, gdy
+  // coroutine już się zakończyła.
   explicit operator bool() {
     fill();
-    return !h_.done();
+    return buffered() || !h_.done();
   }
 
   // Generator<...>::operator() przenosi ostatnio zapisaną wartość w
   // promise_type::value_. Jeżeli wartość była 'przeterminowana' (full_ ==
   // false), to również wznawiamy coroutine i pobieramy nową wartość.
   T operator()() {
+    if constexpr (Checks::enabled) {
+      fill();
+      assert((buffered() || !h_.done()) && "read past the end of a generator");
+    }
+    T value = std::move(current());
+    consume();
+    return value;
+  }
+
+  // Interfejs zakresu (range), dzięki któremu generator działa w pętli
+  // `for (auto &v : gen)` oraz z std::views. Iterator jest jednoprzebiegowy
+  // (input iterator) - inkrementacja wznawia coroutine.
+  struct iterator {
+    using iterator_concept = std::input_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+
+    Generator *gen_ = nullptr;
+
+    reference operator*() const { return gen_->current(); }
+    iterator &operator++() {
+      gen_->consume();
+      gen_->fill();
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+    bool operator==(std::default_sentinel_t) const {
+      return !gen_->buffered() && gen_->h_.done();
+    }
+  };
+
+  iterator begin() {
     fill();
-    full_ = false;
-    return std::move(h_.promise().value_);
+    return {this};
+  }
+  std::default_sentinel_t end() { return {}; }
+
+  // Pomija n kolejnych wartości. Przy Seek = seekable przekazujemy coroutine
+  // liczbę wartości do pominięcia i wystarcza jedno wznowienie - w przeciwnym
+  // wypadku wznawiamy ją n razy.
+  void advance(std::size_t n) {
+    if constexpr (Checks::enabled) {
+      while (n > 0) {
+        fill();
+        if (!buffered() && h_.done())
+          return;
+        [[maybe_unused]] bool seek = !buffered();
+        consume();
+        n--;
+        if constexpr (Seek::enabled)
+          if (seek) {
+            h_.promise().skip_ = n;
+            return;
+          }
+      }
+    } else if constexpr (Seek::enabled) {
+      // Bez kontroli kolejne wznowienie i tak wygeneruje następną wartość,
+      // więc pomijamy n wartości za nią.
+      h_.promise().skip_ = n;
+    } else {
+      for (; n > 0; n--) {
+        resume();
+        if (h_.done())
+          return;
+      }
+    }
   }
 
 private:
@@ -299,18 +595,73 @@ private:
   // prawidłowa i można ją wyciągnąć za pomocą Generator<...>::operator(), czy
   // powinniśmy wczytać nową wartość. Logikę tę realizuje funkcja
   // Generator<...>::fill().
-  bool full_ = false;
+  //
+  // Przy eager_start coroutine zatrzymała się już przy utworzeniu, więc
+  // pierwsza wartość jest od razu prawidłowa.
+  //
+  // Przy unchecked pole nie jest używane - każde fill() wznawia coroutine.
+  bool full_ = Start::run_ahead > 0;
+
+  // Czy bieżąca wartość pochodzi z bufora eager_start<K>.
+  bool buffered() const {
+    if constexpr (ahead > 0)
+      return h_.promise().buffer_.pos_ < h_.promise().buffer_.count_;
+    else
+      return false;
+  }
+
+  reference current() {
+    if constexpr (ahead > 0)
+      if (buffered())
+        return h_.promise().buffer_.values_[h_.promise().buffer_.pos_];
+    return h_.promise().value_;
+  }
+
+  // Oznacza bieżącą wartość jako odczytaną. Wartości z bufora nie wymagają
+  // wznawiania coroutine, więc full_ pozostaje ustawione.
+  void consume() {
+    if constexpr (ahead > 0)
+      if (buffered()) {
+        h_.promise().buffer_.pos_++;
+        return;
+      }
+    if constexpr (Checks::enabled)
+      full_ = false;
+  }
+
+  void resume() {
+    assert(h_ && "use of a moved-from generator");
+    assert(!h_.done() && "resume of a finished generator");
+    if constexpr (requires { h_.promise().on_resume(); })
+      h_.promise().on_resume();
+    h_();
+    if constexpr (requires { h_.promise().on_suspend(); })
+      h_.promise().on_suspend();
+  }
 
   void fill() {
-    if (!full_) {
-      // Wznawiamy coroutine.
-      h_();
+    if constexpr (!Checks::enabled) {
+      resume();
+    } else {
+      assert(h_ && "use of a moved-from generator");
+      if (!full_) {
+        // Wznawiamy coroutine.
+        resume();
 
-      // Propagujemy wyjątek do kodu wywołującego coroutine, jeżeli wystąpił.
-      if (h_.promise().exception_)
-        std::rethrow_exception(h_.promise().exception_);
+        // Propagujemy wyjątek do kodu wywołującego coroutine, jeżeli
+        // wystąpił.
+        if (h_.promise().exception_)
+          std::rethrow_exception(h_.promise().exception_);
 
-      full_ = true;
+        full_ = true;
+      }
+      // Wyjątek rzucony przed pierwszym zawieszeniem coroutine z eager_start
+      // wystąpił jeszcze w trakcie jej tworzenia. Wartości zbuforowane przed
+      // nim oddajemy najpierw, a wyjątek rzucamy dopiero po opróżnieniu
+      // bufora.
+      if constexpr (Start::run_ahead > 0)
+        if (!buffered() && h_.promise().exception_)
+          std::rethrow_exception(h_.promise().exception_);
     }
   }
 };
@@ -357,6 +708,6181 @@ auto main() -> void {
 }
 } // namespace p3
 
+// 4. Przykład - prosty planista (scheduler) oraz asynchroniczne prymitywy
+// synchronizacji: async_mutex, async_event i async_condition_variable.
+//
+// W p1 koordynacja polegała na ręcznym wznawianiu uchwytów przez main. Tutaj
+// coroutines zawieszają się na prymitywach synchronizacji, a wznawia je
+// planista, który pobiera uchwyty z kolejki gotowych do wykonania.
+namespace p4 {
+
+// Węzeł listy oczekujących coroutines. Przechowywany jest bezpośrednio w
+// obiekcie 'awaitera', który żyje w ramce zawieszonej coroutine aż do jej
+// wznowienia - dzięki temu kolejkowanie nie wymaga żadnej alokacji.
+struct waiter {
+  std::coroutine_handle<> handle_;
+  waiter *next_ = nullptr;
+};
+
+// Intruzywna lista jednokierunkowa z zapamiętanym ogonem. Przeniesienie
+// wszystkich elementów do innej listy (splice) ma koszt O(1), niezależnie od
+// liczby oczekujących.
+struct waiter_list {
+  waiter *head_ = nullptr;
+  waiter *tail_ = nullptr;
+
+  bool empty() const { return head_ == nullptr; }
+
+  void push_back(waiter *w) {
+    w->next_ = nullptr;
+    if (tail_)
+      tail_->next_ = w;
+    else
+      head_ = w;
+    tail_ = w;
+  }
+
+  waiter *pop_front() {
+    waiter *w = head_;
+    if (w) {
+      head_ = w->next_;
+      if (!head_)
+        tail_ = nullptr;
+    }
+    return w;
+  }
+
+  // Przenosi wszystkie elementy z other na koniec tej listy.
+  void splice(waiter_list &other) {
+    if (other.empty())
+      return;
+    if (tail_)
+      tail_->next_ = other.head_;
+    else
+      head_ = other.head_;
+    tail_ = other.tail_;
+    other.head_ = other.tail_ = nullptr;
+  }
+};
+
+class scheduler;
+
+// Zadanie asynchroniczne. Podobnie jak p3::Generator jest właścicielem ramki
+// coroutine (RAII), ale zamiast generować wartości może być uruchomione przez
+// planistę (scheduler::spawn) albo oczekiwane z innego zadania
+// (`co_await t`).
+struct task {
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type {
+    // Planista, który uruchomił zadanie (nullptr dla zadań oczekiwanych przez
+    // inne zadania).
+    scheduler *sched_ = nullptr;
+    // Coroutine oczekująca na zakończenie tego zadania.
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr exception_;
+    // Węzeł używany przy pierwszym wstawieniu do kolejki planisty.
+    waiter node_;
+
+    task get_return_object() { return {handle_type::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // Po zakończeniu przekazujemy sterowanie bezpośrednio do oczekującej
+    // coroutine (tzw. symmetric transfer - nie rośnie stos), a jeżeli takiej
+    // nie ma, zgłaszamy planiście zakończenie zadania.
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(handle_type h) noexcept;
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception_ = std::current_exception(); }
+    void return_void() {}
+  };
+
+  handle_type h_;
+
+  task(handle_type h) : h_(h) {}
+  task(task &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+  task &operator=(task &&other) noexcept {
+    if (this != &other) {
+      if (h_)
+        h_.destroy();
+      h_ = std::exchange(other.h_, {});
+    }
+    return *this;
+  }
+  ~task() {
+    if (h_)
+      h_.destroy();
+  }
+
+  // Oczekiwanie na zadanie z innej coroutine - zapamiętujemy kontynuację i
+  // od razu przechodzimy do wykonywania zadania.
+  struct awaiter {
+    handle_type h_;
+    bool await_ready() { return h_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) {
+      h_.promise().continuation_ = cont;
+      return h_;
+    }
+    void await_resume() {
+      if (h_.promise().exception_)
+        std::rethrow_exception(h_.promise().exception_);
+    }
+  };
+  awaiter operator co_await() { return {h_}; }
+
+  // Propaguje wyjątek z zakończonego zadania uruchomionego przez planistę.
+  void get() {
+    if (h_.promise().exception_)
+      std::rethrow_exception(h_.promise().exception_);
+  }
+};
+
+// Planista z kolejką gotowych coroutines wykonywaną przez jeden lub więcej
+// wątków. Kolejka jest listą węzłów waiter, więc wznowienie całej grupy
+// oczekujących to jedno splice pod jednym zajęciem blokady.
+class scheduler {
+public:
+  // Wstawia zadanie do kolejki. Zadanie musi żyć do końca scheduler::run().
+  //
+  // Oprócz p4::task może to być dowolny typ zadania, którego promise_type ma
+  // pola sched_ i node_ oraz po zakończeniu woła task_done() (przykład p10).
+  template <typename Task> void spawn(Task &t) {
+    auto &p = t.h_.promise();
+    p.sched_ = this;
+    p.node_.handle_ = t.h_;
+    {
+      std::lock_guard lock(mutex_);
+      ++live_;
+    }
+    schedule(&p.node_);
+  }
+
+  void schedule(waiter *w) {
+    {
+      std::lock_guard lock(mutex_);
+      ready_.push_back(w);
+    }
+    cv_.notify_one();
+  }
+
+  void schedule(waiter_list &ws) {
+    if (ws.empty())
+      return;
+    {
+      std::lock_guard lock(mutex_);
+      ready_.splice(ws);
+    }
+    cv_.notify_all();
+  }
+
+  // Oddaje wątek innym coroutines - bieżąca trafia na koniec kolejki.
+  //
+  // Użycie: `co_await sched.yield();`
+  struct yield_awaiter {
+    scheduler &sched_;
+    waiter node_;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+      node_.handle_ = h;
+      sched_.schedule(&node_);
+    }
+    void await_resume() {}
+  };
+  yield_awaiter yield() { return {*this, {}}; }
+
+  static constexpr std::size_t max_workers = 64;
+
+  scheduler() = default;
+  ~scheduler() { stop(); }
+
+  // Wykonuje zadania na bieżącym wątku i threads - 1 wątkach pomocniczych
+  // (oprócz tych z start()), dopóki wszystkie uruchomione zadania się nie
+  // zakończą.
+  void run(std::size_t threads = 1) {
+    std::size_t first = 1 + pool_.size();
+    threads = std::clamp<std::size_t>(threads, 1, max_workers - pool_.size());
+    std::vector<std::thread> workers;
+    for (std::size_t i = first; i < first + threads - 1; i++)
+      workers.emplace_back([this, i] { work(i, false); });
+    work(0, false);
+    for (auto &w : workers)
+      w.join();
+  }
+
+  // Uruchamia threads - 1 wątków pomocniczych, które czekają na zadania
+  // również między kolejnymi wywołaniami run(), aż do stop(). Przy pracy
+  // paczkami (przykłady p22 i p25) każda paczka to spawn() i run() bez
+  // tworzenia wątków od nowa.
+  void start(std::size_t threads) {
+    threads = std::clamp<std::size_t>(threads, 1, max_workers);
+    for (std::size_t i = pool_.size() + 1; i < threads; i++)
+      pool_.emplace_back([this, i] { work(i, true); });
+  }
+
+  void stop() {
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto &w : pool_)
+      w.join();
+    pool_.clear();
+    stopping_ = false;
+  }
+
+  // Zgłoszenie zakończenia zadania uruchomionego przez spawn().
+  void task_done() {
+    bool last;
+    {
+      std::lock_guard lock(mutex_);
+      last = --live_ == 0;
+    }
+    if (last)
+      cv_.notify_all();
+  }
+
+  // Stan wątku roboczego publikowany dla obserwatorów z innych wątków
+  // (przykład p11). resumed_at_ to czas ostatniego wznowienia w ns zegara
+  // steady_clock albo 0, gdy wątek czeka na pracę. Para nie mieści się w
+  // jednym słowie, więc chroni ją seqlock: nieparzysty sequence_ oznacza
+  // zapis w toku, a zmiana sequence_ podczas odczytu - odczyt niespójny.
+  struct alignas(64) worker_state {
+    struct snapshot {
+      std::int64_t resumed_at_;
+      void *running_;
+    };
+
+    // Zapisuje tylko wątek, do którego należy stan. Pola zapisujemy z
+    // release, a czytamy z acquire zamiast barier - czytelnik, który widzi
+    // nową wartość pola, widzi też nieparzysty sequence_ (na x86 to zwykłe
+    // instrukcje mov).
+    void publish(std::int64_t resumed_at, void *running) {
+      auto seq = sequence_.load(std::memory_order_relaxed);
+      sequence_.store(seq + 1, std::memory_order_relaxed);
+      resumed_at_.store(resumed_at, std::memory_order_release);
+      running_.store(running, std::memory_order_release);
+      sequence_.store(seq + 2, std::memory_order_release);
+    }
+
+    // Spójna para albo nullopt, gdy odczyt trafił na zapis.
+    std::optional<snapshot> read() const {
+      auto seq = sequence_.load(std::memory_order_acquire);
+      if (seq & 1)
+        return std::nullopt;
+      snapshot s{resumed_at_.load(std::memory_order_acquire),
+                 running_.load(std::memory_order_acquire)};
+      if (sequence_.load(std::memory_order_relaxed) != seq)
+        return std::nullopt;
+      return s;
+    }
+
+  private:
+    std::atomic<std::uint64_t> sequence_ = 0;
+    std::atomic<std::int64_t> resumed_at_ = 0;
+    std::atomic<void *> running_ = nullptr;
+  };
+
+  // Włącza zapisywanie worker_state przy każdym wznowieniu - kosztem odczytu
+  // zegara i zapisu pod seqlockiem.
+  void track_resumes(bool enabled) {
+    tracking_.store(enabled, std::memory_order_relaxed);
+  }
+  const worker_state &worker(std::size_t i) const { return workers_[i]; }
+
+  static std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+private:
+  // Wątek z start() kończy pracę dopiero przy stop(), pozostałe - gdy nie
+  // ma już uruchomionych zadań.
+  void work(std::size_t index, bool pooled) {
+    auto &state = workers_[index];
+    for (;;) {
+      waiter *w;
+      {
+        std::unique_lock lock(mutex_);
+        if (ready_.empty())
+          state.publish(0, nullptr);
+        cv_.wait(lock, [this, pooled] {
+          return !ready_.empty() || (pooled ? stopping_ : live_ == 0);
+        });
+        if (ready_.empty())
+          return;
+        w = ready_.pop_front();
+      }
+      if (tracking_.load(std::memory_order_relaxed))
+        state.publish(now_ns(), w->handle_.address());
+      w->handle_.resume();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  waiter_list ready_;
+  std::size_t live_ = 0;
+  bool stopping_ = false;
+  std::vector<std::thread> pool_;
+  std::atomic<bool> tracking_ = false;
+  std::array<worker_state, max_workers> workers_;
+};
+
+std::coroutine_handle<>
+task::promise_type::final_awaiter::await_suspend(handle_type h) noexcept {
+  auto &p = h.promise();
+  if (p.continuation_)
+    return p.continuation_;
+  // UWAGA: po task_done() ramka może już zostać zniszczona przez właściciela
+  // zadania, więc nie wolno jej więcej dotykać.
+  if (p.sched_)
+    p.sched_->task_done();
+  return std::noop_coroutine();
+}
+
+// Muteks, na którym coroutine zawiesza się zamiast blokować wątek. Przy
+// zwolnieniu własność przechodzi bezpośrednio na pierwszego oczekującego.
+//
+// Wewnętrzny std::mutex chroni jedynie kilka instrukcji operujących na liście,
+// nigdy nie jest trzymany podczas wykonywania coroutine.
+class async_mutex {
+public:
+  explicit async_mutex(scheduler &sched) : sched_(sched) {}
+
+  struct lock_awaiter {
+    async_mutex &m_;
+    waiter node_;
+
+    bool await_ready() { return m_.try_lock(); }
+    bool await_suspend(std::coroutine_handle<> h) {
+      std::lock_guard lock(m_.guard_);
+      if (!m_.locked_) {
+        m_.locked_ = true;
+        return false;
+      }
+      node_.handle_ = h;
+      m_.waiters_.push_back(&node_);
+      return true;
+    }
+    void await_resume() {}
+  };
+
+  // Użycie: `co_await m.lock(); ... m.unlock();`
+  lock_awaiter lock() { return {*this, {}}; }
+
+  bool try_lock() {
+    std::lock_guard lock(guard_);
+    return !std::exchange(locked_, true);
+  }
+
+  void unlock() {
+    waiter *w;
+    {
+      std::lock_guard lock(guard_);
+      w = waiters_.pop_front();
+      if (!w)
+        locked_ = false;
+    }
+    if (w)
+      sched_.schedule(w);
+  }
+
+private:
+  friend class async_condition_variable;
+
+  // Przekazuje muteks coroutines z listy ws (wznowionym przez zmienną
+  // warunkową). Jeżeli muteks jest wolny, pierwsza z nich dostaje go od razu,
+  // pozostałe trafiają jednym splice do kolejki oczekujących na muteks.
+  void acquire_for(waiter_list &ws) {
+    waiter *first = nullptr;
+    {
+      std::lock_guard lock(guard_);
+      if (!locked_) {
+        locked_ = true;
+        first = ws.pop_front();
+      }
+      waiters_.splice(ws);
+    }
+    if (first)
+      sched_.schedule(first);
+  }
+
+  scheduler &sched_;
+  std::mutex guard_;
+  bool locked_ = false;
+  waiter_list waiters_;
+};
+
+enum class reset { manual, automatic };
+
+// Zdarzenie, na które może czekać dowolna liczba coroutines.
+// * reset::manual - set() wznawia wszystkich oczekujących (jednym splice do
+//   kolejki planisty), a zdarzenie pozostaje ustawione do wywołania reset(),
+// * reset::automatic - set() wznawia dokładnie jednego oczekującego, a jeżeli
+//   nikt nie czeka, pierwszy kolejny wait() przejdzie i wyczyści zdarzenie.
+template <reset Reset> class async_event {
+public:
+  explicit async_event(scheduler &sched, bool set = false)
+      : sched_(sched), set_(set) {}
+
+  struct wait_awaiter {
+    async_event &e_;
+    waiter node_;
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+      std::lock_guard lock(e_.guard_);
+      if (e_.set_) {
+        if constexpr (Reset == reset::automatic)
+          e_.set_ = false;
+        return false;
+      }
+      node_.handle_ = h;
+      e_.waiters_.push_back(&node_);
+      return true;
+    }
+    void await_resume() {}
+  };
+
+  wait_awaiter wait() { return {*this, {}}; }
+
+  void set() {
+    if constexpr (Reset == reset::manual) {
+      waiter_list ws;
+      {
+        std::lock_guard lock(guard_);
+        set_ = true;
+        ws.splice(waiters_);
+      }
+      sched_.schedule(ws);
+    } else {
+      waiter *w;
+      {
+        std::lock_guard lock(guard_);
+        w = waiters_.pop_front();
+        if (!w)
+          set_ = true;
+      }
+      if (w)
+        sched_.schedule(w);
+    }
+  }
+
+  void reset() {
+    std::lock_guard lock(guard_);
+    set_ = false;
+  }
+
+private:
+  scheduler &sched_;
+  std::mutex guard_;
+  bool set_;
+  waiter_list waiters_;
+};
+
+using async_manual_reset_event = async_event<reset::manual>;
+using async_auto_reset_event = async_event<reset::automatic>;
+
+// Zmienna warunkowa współpracująca z async_mutex. Powiadomione coroutines nie
+// trafiają od razu do kolejki planisty, tylko do kolejki oczekujących na
+// muteks (tzw. 'wait morphing') - dzięki temu notify_all() nie budzi wszystkich
+// tylko po to, żeby od razu zawiesiły się ponownie na muteksie.
+//
+// Tak jak w przypadku std::condition_variable, wszyscy oczekujący muszą używać
+// tego samego muteksu, a po wznowieniu coroutine ponownie go posiada.
+class async_condition_variable {
+public:
+  struct wait_awaiter {
+    async_condition_variable &cv_;
+    async_mutex &m_;
+    waiter node_;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+      node_.handle_ = h;
+      {
+        std::lock_guard lock(cv_.guard_);
+        cv_.mutex_ = &m_;
+        cv_.waiters_.push_back(&node_);
+      }
+      // Jeżeli w międzyczasie ktoś wywołał notify, jesteśmy już w kolejce
+      // muteksu i unlock() może przekazać go nam samym - to poprawne.
+      m_.unlock();
+    }
+    void await_resume() {}
+  };
+
+  // Użycie: `while (!warunek) co_await cv.wait(m);`
+  wait_awaiter wait(async_mutex &m) { return {*this, m, {}}; }
+
+  void notify_one() {
+    waiter_list ws;
+    async_mutex *m;
+    {
+      std::lock_guard lock(guard_);
+      if (waiter *w = waiters_.pop_front())
+        ws.push_back(w);
+      m = mutex_;
+    }
+    if (!ws.empty())
+      m->acquire_for(ws);
+  }
+
+  void notify_all() {
+    waiter_list ws;
+    async_mutex *m;
+    {
+      std::lock_guard lock(guard_);
+      ws.splice(waiters_);
+      m = mutex_;
+    }
+    if (!ws.empty())
+      m->acquire_for(ws);
+  }
+
+private:
+  std::mutex guard_;
+  async_mutex *mutex_ = nullptr;
+  waiter_list waiters_;
+};
+
+// Konsument czeka na zmiennej warunkowej aż w kolejce pojawi się element.
+task consumer(async_mutex &m, async_condition_variable &cv,
+              std::vector<int> &queue, bool &closed, int id) {
+  for (;;) {
+    co_await m.lock();
+    while (queue.empty() && !closed)
+      co_await cv.wait(m);
+    if (queue.empty()) {
+      m.unlock();
+      co_return;
+    }
+    int item = queue.back();
+    queue.pop_back();
+    m.unlock();
+    std::cout << "consumer " << id << ": got " << item << std::endl;
+  }
+}
+
+task producer(async_mutex &m, async_condition_variable &cv,
+              std::vector<int> &queue, bool &closed, int count) {
+  for (int i = 0; i < count; i++) {
+    co_await m.lock();
+    queue.push_back(i);
+    std::cout << "producer: put " << i << std::endl;
+    m.unlock();
+    cv.notify_one();
+  }
+  co_await m.lock();
+  closed = true;
+  m.unlock();
+  cv.notify_all();
+}
+
+task waiting(async_manual_reset_event &e, std::atomic<std::size_t> &woken) {
+  co_await e.wait();
+  woken.fetch_add(1, std::memory_order_relaxed);
+}
+
+task signalling(async_manual_reset_event &e) {
+  e.set();
+  co_return;
+}
+
+auto main() -> void {
+  {
+    // Producent i dwóch konsumentów na jednym wątku - wynik deterministyczny.
+    scheduler sched;
+    async_mutex m(sched);
+    async_condition_variable cv;
+    std::vector<int> queue;
+    bool closed = false;
+    task tasks[] = {consumer(m, cv, queue, closed, 0),
+                    consumer(m, cv, queue, closed, 1),
+                    producer(m, cv, queue, closed, 4)};
+    for (auto &t : tasks)
+      sched.spawn(t);
+    sched.run();
+  }
+  {
+    // Tysiące coroutines czekających na jedno zdarzenie, wznawianych przez
+    // kilka wątków.
+    constexpr std::size_t n = 10000;
+    scheduler sched;
+    async_manual_reset_event e(sched);
+    std::atomic<std::size_t> woken = 0;
+    std::vector<task> tasks;
+    for (std::size_t i = 0; i < n; i++)
+      tasks.push_back(waiting(e, woken));
+    tasks.push_back(signalling(e));
+    for (auto &t : tasks)
+      sched.spawn(t);
+    sched.run(4);
+    std::cout << "main: woken " << woken << " of " << n << " waiters"
+              << std::endl;
+  }
+}
+} // namespace p4
+
+// 5. Przykład - asynchroniczny muteks czytelników i pisarzy zoptymalizowany
+// pod przewagę odczytów.
+//
+// Zwykły licznik czytelników we wspólnej zmiennej sprawia, że każdy odczyt
+// modyfikuje tę samą linię pamięci podręcznej, która 'skacze' między rdzeniami
+// (cache-line ping-pong). Tutaj licznik jest rozłożony na Slots niezależnych
+// liczników, każdy we własnej linii - wątek zwiększa tylko swój. Pisarz musi
+// natomiast zsumować wszystkie, co przy rzadkich zapisach jest opłacalne.
+namespace p5 {
+using p4::scheduler;
+using p4::task;
+using p4::waiter;
+using p4::waiter_list;
+
+// Rozmiar linii pamięci podręcznej na typowych procesorach x86-64 i ARM.
+constexpr std::size_t cache_line = 64;
+
+// Kolejny numer przydzielany wątkom przy pierwszym użyciu muteksu.
+inline std::atomic<std::size_t> next_thread_index = 0;
+
+inline std::size_t thread_index() {
+  static thread_local const std::size_t index =
+      next_thread_index.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+// Pisarze mają pierwszeństwo: gdy pisarz czeka, nowi czytelnicy zawieszają
+// się, zamiast dołączać do trwających odczytów. Zarówno pisarz, jak i
+// czytelnik zawsze się zawieszają zamiast blokować wątek.
+//
+// Czytelnik zwalniający blokadę może to zrobić na innym wątku niż ją
+// zajmował, więc pojedyncze liczniki mogą być ujemne - znaczenie ma tylko ich
+// suma.
+template <std::size_t Slots = 64> class async_shared_mutex {
+public:
+  explicit async_shared_mutex(scheduler &sched) : sched_(sched) {}
+
+  struct lock_shared_awaiter {
+    async_shared_mutex &m_;
+    waiter node_;
+
+    bool await_ready() { return m_.try_lock_shared(); }
+    bool await_suspend(std::coroutine_handle<> h) {
+      std::lock_guard lock(m_.guard_);
+      // Pisarz ustawia writer_ tylko pod guard_, więc tutaj nie musimy
+      // sprawdzać flagi drugi raz po zwiększeniu licznika.
+      if (!m_.writer_.load(std::memory_order_relaxed)) {
+        m_.slot().fetch_add(1);
+        return false;
+      }
+      node_.handle_ = h;
+      m_.readers_.push_back(&node_);
+      return true;
+    }
+    void await_resume() {}
+  };
+
+  struct lock_awaiter {
+    async_shared_mutex &m_;
+    waiter node_;
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+      std::lock_guard lock(m_.guard_);
+      node_.handle_ = h;
+      if (m_.writer_.load(std::memory_order_relaxed)) {
+        m_.writers_.push_back(&node_);
+        return true;
+      }
+      m_.writer_.store(true);
+      if (m_.readers() == 0)
+        return false;
+      // Czekamy, aż ostatni czytelnik zwolni blokadę.
+      m_.drain_ = &node_;
+      return true;
+    }
+    void await_resume() {}
+  };
+
+  lock_shared_awaiter lock_shared() { return {*this, {}}; }
+  lock_awaiter lock() { return {*this, {}}; }
+
+  // Szybka ścieżka czytelnika: jedna operacja atomowa na własnym liczniku i
+  // odczyt flagi pisarza, bez żadnej blokady.
+  bool try_lock_shared() {
+    if (writer_.load())
+      return false;
+    slot().fetch_add(1);
+    // Kolejność seq_cst gwarantuje, że albo zobaczymy flagę pisarza, albo
+    // pisarz zobaczy nasz licznik przy sumowaniu.
+    if (writer_.load()) {
+      unlock_shared();
+      return false;
+    }
+    return true;
+  }
+
+  void unlock_shared() {
+    slot().fetch_sub(1);
+    if (writer_.load())
+      wake_drained_writer();
+  }
+
+  void unlock() {
+    waiter *next = nullptr;
+    waiter_list ws;
+    {
+      std::lock_guard lock(guard_);
+      if (waiter *w = writers_.pop_front()) {
+        // Przekazujemy blokadę kolejnemu pisarzowi - writer_ pozostaje
+        // ustawione, ale przejściowo zwiększone liczniki czytelników z
+        // szybkiej ścieżki mogą jeszcze nie być wyzerowane.
+        if (readers() == 0)
+          next = w;
+        else
+          drain_ = w;
+      } else {
+        // Wpuszczamy wszystkich oczekujących czytelników naraz.
+        std::ptrdiff_t n = 0;
+        for (waiter *r = readers_.head_; r; r = r->next_)
+          n++;
+        slots_[0].count_.fetch_add(n);
+        writer_.store(false);
+        ws.splice(readers_);
+      }
+    }
+    if (next)
+      sched_.schedule(next);
+    sched_.schedule(ws);
+  }
+
+private:
+  struct alignas(cache_line) slot_type {
+    std::atomic<std::ptrdiff_t> count_ = 0;
+  };
+
+  std::atomic<std::ptrdiff_t> &slot() {
+    return slots_[thread_index() % Slots].count_;
+  }
+
+  std::ptrdiff_t readers() const {
+    std::ptrdiff_t sum = 0;
+    for (auto &s : slots_)
+      sum += s.count_.load();
+    return sum;
+  }
+
+  void wake_drained_writer() {
+    waiter *w = nullptr;
+    {
+      std::lock_guard lock(guard_);
+      if (drain_ && readers() == 0)
+        w = std::exchange(drain_, nullptr);
+    }
+    if (w)
+      sched_.schedule(w);
+  }
+
+  std::array<slot_type, Slots> slots_;
+  // Ustawiona, gdy pisarz posiada blokadę lub czeka na wyjście czytelników.
+  alignas(cache_line) std::atomic<bool> writer_ = false;
+  scheduler &sched_;
+  std::mutex guard_;
+  waiter *drain_ = nullptr;
+  waiter_list readers_;
+  waiter_list writers_;
+};
+
+// Tablica konfiguracji czytana przez wiele coroutines i rzadko zmieniana.
+struct routing_table {
+  std::array<std::size_t, 16> routes_{};
+  std::size_t version_ = 0;
+};
+
+template <typename Mutex>
+task reader(scheduler &sched, Mutex &m, const routing_table &table,
+            std::size_t reads, std::atomic<std::size_t> &checksum) {
+  std::size_t sum = 0;
+  for (std::size_t i = 0; i < reads; i++) {
+    co_await m.lock_shared();
+    sum += table.routes_[i % table.routes_.size()];
+    m.unlock_shared();
+    if (i % 1024 == 0)
+      co_await sched.yield();
+  }
+  checksum.fetch_add(sum, std::memory_order_relaxed);
+}
+
+template <typename Mutex>
+task writer(scheduler &sched, Mutex &m, routing_table &table,
+            std::size_t writes) {
+  for (std::size_t i = 0; i < writes; i++) {
+    co_await m.lock();
+    table.routes_[i % table.routes_.size()]++;
+    table.version_++;
+    m.unlock();
+    co_await sched.yield();
+  }
+}
+
+// Mierzy średni czas operacji przy wielu czytelnikach i jednym pisarzu.
+template <std::size_t Slots>
+void benchmark(std::size_t threads, std::size_t readers, std::size_t reads,
+               std::size_t writes) {
+  scheduler sched;
+  async_shared_mutex<Slots> m(sched);
+  routing_table table;
+  std::atomic<std::size_t> checksum = 0;
+  std::vector<task> tasks;
+  for (std::size_t i = 0; i < readers; i++)
+    tasks.push_back(reader(sched, m, table, reads, checksum));
+  tasks.push_back(writer(sched, m, table, writes));
+  for (auto &t : tasks)
+    sched.spawn(t);
+
+  auto start = std::chrono::steady_clock::now();
+  sched.run(threads);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  auto ns = std::chrono::duration<double, std::nano>(elapsed).count();
+  std::cout << "main: async_shared_mutex<" << Slots << ">, " << threads
+            << " threads, " << readers << " readers: "
+            << ns / double(readers * reads + writes) << " ns/lock, version "
+            << table.version_ << std::endl;
+}
+
+auto main() -> void {
+  const std::size_t threads =
+      std::max<std::size_t>(2, std::thread::hardware_concurrency());
+  // Slots = 1 odpowiada klasycznemu pojedynczemu licznikowi czytelników.
+  benchmark<1>(threads, 4 * threads, 200000, 100);
+  benchmark<64>(threads, 4 * threads, 200000, 100);
+}
+} // namespace p5
+
+// 6. Przykład - asynchroniczna bariera dla algorytmów fazowych.
+//
+// N coroutines wykonuje fazę obliczeń, a następnie czeka, aż wszystkie ją
+// skończą. Przy dużej liczbie uczestników jeden wspólny licznik przybyć
+// staje się wąskim gardłem, więc przybycia zliczane są w drzewie: każdy węzeł
+// ma licznik dla co najwyżej fan_in dzieci, a do rodzica przechodzi tylko
+// ostatni przybyły. Oczekujący trafiają na listę swojego liścia, obok jego
+// licznika, więc i tu rywalizuje najwyżej fan_in uczestników. Ostatni
+// przybyły do korzenia wywołuje funkcję kończącą fazę, łączy listy liści i
+// przekazuje je planiście jako jedną partię.
+namespace p6 {
+using p4::scheduler;
+using p4::task;
+using p4::waiter;
+using p4::waiter_list;
+
+template <std::invocable Completion> class async_barrier {
+public:
+  async_barrier(scheduler &sched, std::size_t participants,
+                Completion completion, std::size_t fan_in = 4)
+      : sched_(sched), fan_in_(std::max<std::size_t>(2, fan_in)),
+        completion_(std::move(completion)) {
+    // Budujemy drzewo poziomami - od liści do korzenia. Liść i obsługuje
+    // uczestników [i * fan_in, (i + 1) * fan_in).
+    std::size_t level_begin = 0;
+    std::size_t arrivals = participants;
+    leaves_ = (participants + fan_in_ - 1) / fan_in_;
+    do {
+      std::size_t count = (arrivals + fan_in_ - 1) / fan_in_;
+      for (std::size_t i = 0; i < count; i++)
+        nodes_.emplace_back(std::min(fan_in_, arrivals - i * fan_in_));
+      std::size_t level_end = nodes_.size();
+      if (count > 1)
+        for (std::size_t i = 0; i < count; i++)
+          nodes_[level_begin + i].parent_ = level_end + i / fan_in_;
+      level_begin = level_end;
+      arrivals = count;
+    } while (arrivals > 1);
+  }
+
+  struct arrive_awaiter {
+    async_barrier &b_;
+    std::size_t id_;
+    waiter node_;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+      node_.handle_ = h;
+      // Najpierw dołączamy do listy oczekujących liścia, dopiero potem
+      // zgłaszamy przybycie - inaczej ostatni uczestnik mógłby zakończyć fazę
+      // przed naszym wstawieniem. Pierwszy wstawiony zostaje ogonem listy.
+      node &leaf = b_.nodes_[id_ / b_.fan_in_];
+      waiter *head = leaf.waiting_.load(std::memory_order_relaxed);
+      do
+        node_.next_ = head;
+      while (!leaf.waiting_.compare_exchange_weak(head, &node_,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed));
+      if (!head)
+        leaf.tail_ = &node_;
+      // UWAGA: po zgłoszeniu przybycia coroutine mogła już zostać wznowiona
+      // na innym wątku, więc nie wolno dotykać node_.
+      if (b_.arrive(id_))
+        b_.complete_phase();
+    }
+    void await_resume() {}
+  };
+
+  // Uczestnik id (0 <= id < participants) kończy bieżącą fazę.
+  arrive_awaiter arrive_and_wait(std::size_t id) { return {*this, id, {}}; }
+
+  std::size_t phase() const { return phase_; }
+
+private:
+  struct alignas(p5::cache_line) node {
+    explicit node(std::size_t expected) : expected_(expected) {}
+    node(node &&other) noexcept
+        : expected_(other.expected_), parent_(other.parent_) {}
+
+    std::atomic<std::size_t> count_ = 0;
+    std::size_t expected_;
+    std::size_t parent_ = npos;
+    // Tylko w liściach: oczekujący uczestnicy, od ostatnio wstawionego.
+    std::atomic<waiter *> waiting_ = nullptr;
+    waiter *tail_ = nullptr;
+  };
+  static constexpr std::size_t npos = std::size_t(-1);
+
+  // Zwraca true dla ostatniego przybyłego w całej fazie.
+  bool arrive(std::size_t id) {
+    std::size_t i = id / fan_in_;
+    for (;;) {
+      node &n = nodes_[i];
+      if (n.count_.fetch_add(1, std::memory_order_acq_rel) + 1 < n.expected_)
+        return false;
+      // Nikt nie przybędzie do tego węzła ponownie przed końcem fazy, więc
+      // możemy od razu przygotować go na następną.
+      n.count_.store(0, std::memory_order_relaxed);
+      if (n.parent_ == npos)
+        return true;
+      i = n.parent_;
+    }
+  }
+
+  void complete_phase() {
+    completion_();
+    phase_++;
+    // Przybycia łańcuchem liczników acq_rel gwarantują, że widzimy wstawienia
+    // wszystkich uczestników i ogony list.
+    waiter_list ws;
+    for (std::size_t i = 0; i < leaves_; i++) {
+      waiter_list leaf;
+      leaf.head_ = nodes_[i].waiting_.exchange(nullptr,
+                                               std::memory_order_acquire);
+      leaf.tail_ = std::exchange(nodes_[i].tail_, nullptr);
+      ws.splice(leaf);
+    }
+    sched_.schedule(ws);
+  }
+
+  scheduler &sched_;
+  std::size_t fan_in_;
+  Completion completion_;
+  std::vector<node> nodes_;
+  std::size_t leaves_;
+  std::size_t phase_ = 0;
+};
+
+// Każdy uczestnik w każdej fazie dodaje swój wkład do sumy częściowej.
+template <typename Barrier>
+task participant(Barrier &barrier, std::vector<std::size_t> &partial,
+                 std::size_t id, std::size_t phases) {
+  for (std::size_t phase = 0; phase < phases; phase++) {
+    partial[id] += id * (phase + 1);
+    co_await barrier.arrive_and_wait(id);
+  }
+}
+
+void run(std::size_t participants, std::size_t phases, std::size_t fan_in,
+         bool verbose) {
+  scheduler sched;
+  std::vector<std::size_t> partial(participants);
+  async_barrier barrier(
+      sched, participants,
+      [&] {
+        if (!verbose)
+          return;
+        std::size_t sum = 0;
+        for (auto v : partial)
+          sum += v;
+        std::cout << "completion: sum " << sum << std::endl;
+      },
+      fan_in);
+  std::vector<task> tasks;
+  for (std::size_t i = 0; i < participants; i++)
+    tasks.push_back(participant(barrier, partial, i, phases));
+  for (auto &t : tasks)
+    sched.spawn(t);
+
+  auto start = std::chrono::steady_clock::now();
+  sched.run(std::max<std::size_t>(2, std::thread::hardware_concurrency()));
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  if (!verbose) {
+    auto ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    std::cout << "main: " << participants << " participants, fan-in "
+              << fan_in << ": " << ns / double(phases) << " ns/phase"
+              << std::endl;
+  }
+}
+
+auto main() -> void {
+  run(1000, 3, 4, true);
+  // fan_in >= participants oznacza jeden wspólny licznik.
+  run(10000, 20, 10000, false);
+  run(10000, 20, 8, false);
+}
+} // namespace p6
+
+// 7. Przykład - cykliczne (round-robin) przeplatanie wielu coroutines na
+// jednym wątku.
+//
+// W p1 main wznawiał jedną coroutine. Przy tysiącach coroutines trzymanie ich
+// w liście wiązanej oznaczałoby skakanie po wskaźnikach przy każdym kroku.
+// Tutaj uchwyty leżą w ciągłej tablicy, wznawiane są po kolei, a zakończone
+// coroutines są usuwane w tym samym przebiegu przez przesunięcie pozostałych
+// (kolejność jest zachowana).
+namespace p7 {
+
+// Statystyki pojedynczej rundy.
+struct round_stats {
+  std::size_t resumed_ = 0;
+  std::size_t finished_ = 0;
+  std::chrono::nanoseconds duration_{};
+};
+
+class round_robin {
+public:
+  round_robin() = default;
+  round_robin(const round_robin &) = delete;
+  round_robin &operator=(const round_robin &) = delete;
+  // Niszczymy coroutines, które nie zdążyły się zakończyć.
+  ~round_robin() {
+    for (auto h : run_)
+      h.destroy();
+  }
+
+  // Przejmuje na własność zawieszoną coroutine (np. p1::coroutine).
+  void add(std::coroutine_handle<> h) { run_.push_back(h); }
+  void reserve(std::size_t n) { run_.reserve(n); }
+  std::size_t size() const { return run_.size(); }
+
+  // Wznawia raz każdą żywą coroutine w kolejności dodania.
+  round_stats round() {
+    // Ramki kolejnych coroutines leżą w różnych miejscach sterty, więc
+    // pobieramy je do pamięci podręcznej z wyprzedzeniem.
+    constexpr std::size_t prefetch_distance = 8;
+
+    auto start = std::chrono::steady_clock::now();
+    std::size_t n = run_.size();
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < n; i++) {
+      if (i + prefetch_distance < n)
+        __builtin_prefetch(run_[i + prefetch_distance].address());
+      auto h = run_[i];
+      h();
+      if (h.done())
+        h.destroy();
+      else
+        run_[kept++] = h;
+    }
+    run_.resize(kept);
+    return {n, n - kept, std::chrono::steady_clock::now() - start};
+  }
+
+  // Wykonuje rundy, dopóki wszystkie coroutines się nie zakończą lub nie
+  // zostanie osiągnięty limit rund.
+  std::vector<round_stats> run(std::size_t max_rounds) {
+    std::vector<round_stats> stats;
+    while (!run_.empty() && stats.size() < max_rounds)
+      stats.push_back(round());
+    return stats;
+  }
+
+private:
+  std::vector<std::coroutine_handle<>> run_;
+};
+
+// Coroutine w stylu p1::counter, ale bez wypisywania na ekran i kończąca się
+// po steps krokach.
+p1::coroutine ticker(std::size_t steps, std::size_t &ticks) {
+  for (std::size_t i = 0; i < steps; i++) {
+    ticks++;
+    co_await std::suspend_always();
+  }
+}
+
+auto main() -> void {
+  constexpr std::size_t n = 1 << 20;
+  std::size_t ticks = 0;
+  round_robin rr;
+  rr.reserve(n);
+  for (std::size_t i = 0; i < n; i++)
+    rr.add(ticker(i % 4 + 1, ticks));
+
+  auto stats = rr.run(10);
+  for (std::size_t i = 0; i < stats.size(); i++) {
+    auto &s = stats[i];
+    std::cout << "main: round " << i << ": resumed " << s.resumed_
+              << ", finished " << s.finished_ << ", "
+              << double(s.duration_.count()) / double(s.resumed_)
+              << " ns/resume" << std::endl;
+  }
+  std::cout << "main: total ticks " << ticks << std::endl;
+}
+} // namespace p7
+
+// 8. Przykład - zużycie pamięci przez miliony zawieszonych coroutines oraz
+// 'odchudzona' obietnica.
+//
+// Każda zawieszona coroutine to ramka na stercie: wskaźniki na funkcje
+// wznowienia i zniszczenia, obiekt promise, parametry oraz zmienne lokalne
+// żyjące w poprzek punktów zawieszenia. Przy jednej coroutine na połączenie
+// liczy się każdy bajt promise.
+namespace p8 {
+
+// Liczniki alokacji aktualizowane przez zastąpiony globalny operator new
+// (zdefiniowany poza przestrzenią nazw, bo tak wymaga standard) - tylko gdy
+// ustawiona jest flaga counting, czyli w czasie życia counting_scope. Poza
+// pomiarem operator new jedynie odczytuje flagę, więc wielowątkowe przykłady
+// nie płacą za wspólne operacje atomowe.
+alignas(64) inline std::atomic<bool> counting = false;
+alignas(64) inline std::atomic<std::size_t> allocations = 0;
+inline std::atomic<std::size_t> allocated_bytes = 0;
+
+class counting_scope {
+public:
+  counting_scope()
+      : previous_(counting.exchange(true, std::memory_order_relaxed)) {}
+  counting_scope(const counting_scope &) = delete;
+  counting_scope &operator=(const counting_scope &) = delete;
+  ~counting_scope() { counting.store(previous_, std::memory_order_relaxed); }
+
+private:
+  bool previous_;
+};
+
+struct alloc_snapshot {
+  std::size_t allocations_ = allocations.load(std::memory_order_relaxed);
+  std::size_t bytes_ = allocated_bytes.load(std::memory_order_relaxed);
+
+  alloc_snapshot operator-(const alloc_snapshot &other) const {
+    return {allocations_ - other.allocations_, bytes_ - other.bytes_};
+  }
+};
+
+// Generator o interfejsie p3::Generator, ale z minimalną obietnicą:
+// * zamiast kopii wartości trzymamy wskaźnik na nią - obiekt z wyrażenia
+//   `co_yield expr` żyje w ramce aż do wznowienia coroutine,
+// * nie przechowujemy std::exception_ptr - unhandled_exception() rzuca wyjątek
+//   ponownie, więc wydostaje się on bezpośrednio z h_() w kodzie wołającym.
+//
+// Jest to rozwiązanie 'opt-in': w przeciwieństwie do p3::Generator wartość
+// jest dostępna tylko do następnego wznowienia i jest kopiowana przy odczycie.
+template <typename T> struct SlimGenerator {
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type {
+    const T *value_ = nullptr;
+
+    SlimGenerator get_return_object() {
+      return {handle_type::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void unhandled_exception() { throw; }
+
+    std::suspend_always yield_value(const T &value) noexcept {
+      value_ = std::addressof(value);
+      return {};
+    }
+    void return_void() {}
+  };
+
+  handle_type h_;
+
+  SlimGenerator(handle_type h) : h_(h) {}
+  SlimGenerator(SlimGenerator &&other) noexcept
+      : h_(std::exchange(other.h_, {})), full_(other.full_) {}
+  SlimGenerator &operator=(SlimGenerator &&other) noexcept {
+    if (this != &other) {
+      if (h_)
+        h_.destroy();
+      h_ = std::exchange(other.h_, {});
+      full_ = other.full_;
+    }
+    return *this;
+  }
+  ~SlimGenerator() {
+    if (h_)
+      h_.destroy();
+  }
+
+  explicit operator bool() {
+    fill();
+    return !h_.done();
+  }
+
+  T operator()() {
+    fill();
+    full_ = false;
+    return *h_.promise().value_;
+  }
+
+private:
+  bool full_ = false;
+
+  void fill() {
+    if (!full_) {
+      h_();
+      full_ = true;
+    }
+  }
+};
+
+// Odpowiednik p3::counter bez wypisywania na ekran.
+SlimGenerator<std::size_t> slim_counter(std::size_t max) {
+  for (std::size_t i = 0; i < max; i++)
+    co_yield i;
+}
+
+// Tworzy n zawieszonych coroutines za pomocą make() i wypisuje średni rozmiar
+// ramki oraz faktyczny przyrost sterty (z narzutem alokatora).
+template <typename Make>
+void footprint(const char *name, std::size_t n, Make make) {
+  using coroutine_type = decltype(make());
+  std::vector<coroutine_type> frames;
+  frames.reserve(n);
+
+#if defined(__GLIBC__)
+  auto heap_before = mallinfo2().uordblks;
+#endif
+  counting_scope counting;
+  auto before = alloc_snapshot{};
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < n; i++)
+    frames.push_back(make());
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  auto diff = alloc_snapshot{} - before;
+
+  std::cout << "main: " << name << ": " << double(diff.bytes_) / double(n)
+            << " bytes/frame";
+#if defined(__GLIBC__)
+  std::cout << " ("
+            << double(mallinfo2().uordblks - heap_before) / double(n)
+            << " bytes/frame on heap)";
+#endif
+  std::cout << ", "
+            << std::chrono::duration<double, std::nano>(elapsed).count() /
+                   double(n)
+            << " ns/frame" << std::endl;
+
+  if constexpr (std::is_same_v<coroutine_type, p1::coroutine>)
+    for (auto h : frames)
+      h.destroy();
+}
+
+auto main() -> void {
+  constexpr std::size_t n = 1 << 20;
+  footprint("p1::counter()", n, [] { return p1::counter(); });
+  footprint("p3::counter(3)", n, [] { return p3::counter(3); });
+  footprint("slim_counter(3)", n, [] { return slim_counter(3); });
+
+  auto gen = slim_counter(3);
+  while (gen)
+    std::cout << "main: got from slim coroutine: " << gen() << std::endl;
+}
+} // namespace p8
+
+// Zastąpienie globalnego operatora new zliczające alokacje (również ramek
+// coroutines, które domyślnie trafiają właśnie tutaj) w czasie pomiaru.
+//
+// Operatory delete nie są rozwijane w miejscu wywołania, inaczej GCC błędnie
+// zgłasza niedopasowanie std::free() z operatorem new.
+void *operator new(std::size_t size) {
+  if (p8::counting.load(std::memory_order_relaxed)) {
+    p8::allocations.fetch_add(1, std::memory_order_relaxed);
+    p8::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept {
+  std::free(p);
+}
+
+// 9. Przykład - ponowne użycie ramek coroutines bez udziału alokatora.
+//
+// Generatory takie jak p3::counter(max) są często tworzone w pętli: każde
+// wywołanie alokuje ramkę, a po zakończeniu ją zwalnia. Ramki tej samej
+// funkcji mają zawsze ten sam rozmiar, więc zwolnioną ramkę można odłożyć na
+// bok i oddać przy następnym wywołaniu - w stanie ustalonym alokator nie jest
+// w ogóle wołany.
+//
+// Standard nie pozwala 'zrestartować' zakończonej coroutine z nowymi
+// parametrami, ale odzyskanie jej pamięci daje ten sam efekt: nowa ramka
+// powstaje dokładnie w miejscu poprzedniej, wciąż gorącej w pamięci
+// podręcznej.
+namespace p9 {
+
+// Pula wolnych ramek, osobna dla każdego wątku (nie wymaga synchronizacji).
+// Ramki są grupowane w klasy rozmiarów co granularity bajtów, a w każdej
+// klasie trzymamy co najwyżej max_cached ramek.
+class frame_pool {
+public:
+  static constexpr std::size_t granularity = 16;
+  static constexpr std::size_t classes = 64;
+  static constexpr std::size_t max_cached = 64;
+
+  static void *allocate(std::size_t size) {
+    std::size_t c = size_class(size);
+    if (c >= classes)
+      return ::operator new(size);
+    auto &pool = local();
+    if (node *n = pool.free_[c]) {
+      pool.free_[c] = n->next_;
+      pool.cached_[c]--;
+      pool.reused_++;
+      return n;
+    }
+    return ::operator new((c + 1) * granularity);
+  }
+
+  static void deallocate(void *p, std::size_t size) noexcept {
+    std::size_t c = size_class(size);
+    if (c < classes) {
+      auto &pool = local();
+      if (pool.cached_[c] < max_cached) {
+        pool.free_[c] = new (p) node{pool.free_[c]};
+        pool.cached_[c]++;
+        return;
+      }
+    }
+    ::operator delete(p);
+  }
+
+  // Liczba alokacji obsłużonych z puli na bieżącym wątku.
+  static std::size_t reused() { return local().reused_; }
+
+private:
+  struct node {
+    node *next_;
+  };
+
+  static std::size_t size_class(std::size_t size) {
+    return (size + granularity - 1) / granularity - 1;
+  }
+
+  struct local_pool {
+    std::array<node *, classes> free_{};
+    std::array<std::size_t, classes> cached_{};
+    std::size_t reused_ = 0;
+
+    // Przy zakończeniu wątku oddajemy ramki alokatorowi.
+    ~local_pool() {
+      for (node *n : free_)
+        while (n)
+          ::operator delete(std::exchange(n, n->next_));
+    }
+  };
+
+  static local_pool &local() {
+    static thread_local local_pool pool;
+    return pool;
+  }
+};
+
+// Klasa bazowa promise_type kierująca alokację ramki do puli.
+struct pooled_frame {
+  static void *operator new(std::size_t size) {
+    return frame_pool::allocate(size);
+  }
+  static void operator delete(void *p, std::size_t size) noexcept {
+    frame_pool::deallocate(p, size);
+  }
+};
+
+template <typename T> using PooledGenerator = p3::Generator<T, pooled_frame>;
+
+// Odpowiedniki p3::counter bez wypisywania na ekran.
+p3::Generator<std::size_t> counter(std::size_t max) {
+  for (std::size_t i = 0; i < max; i++)
+    co_yield i;
+}
+
+PooledGenerator<std::size_t> pooled_counter(std::size_t max) {
+  for (std::size_t i = 0; i < max; i++)
+    co_yield i;
+}
+
+// Wywołuje make(max) wielokrotnie, za każdym razem konsumując cały generator.
+template <typename Make>
+void benchmark(const char *name, std::size_t calls, Make make) {
+  std::size_t sum = 0;
+  p8::counting_scope counting;
+  auto before = p8::alloc_snapshot{};
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < calls; i++) {
+    auto gen = make(i % 8);
+    while (gen)
+      sum += gen();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  auto diff = p8::alloc_snapshot{} - before;
+  std::cout << "main: " << name << ": "
+            << std::chrono::duration<double, std::nano>(elapsed).count() /
+                   double(calls)
+            << " ns/call, " << diff.allocations_ << " allocations, sum " << sum
+            << std::endl;
+}
+
+auto main() -> void {
+  constexpr std::size_t calls = 1000000;
+  benchmark("counter", calls, counter);
+  benchmark("pooled_counter", calls, pooled_counter);
+  std::cout << "main: frames reused from pool: " << frame_pool::reused()
+            << std::endl;
+}
+} // namespace p9
+
+// 10. Przykład - asynchroniczny stos wywołań i profiler próbkujący.
+//
+// Zwykły profiler (np. perf) widzi na stosie tylko planistę i
+// std::coroutine_handle<>::resume() - nie wie, która coroutine czeka na którą.
+// Tutaj każde zadanie pamięta zadanie, które na nie czeka (rodzica), a wątek
+// pamięta aktualnie wykonywane zadanie. Procedura obsługi sygnału SIGPROF
+// przechodzi po tej liście i zapisuje logiczny stos, z którego na końcu
+// budujemy tzw. 'folded stacks' - format wejściowy skryptów flamegraph.
+//
+// Śledzenie jest 'opt-in': używa go tylko typ traced_task, a p4::task
+// pozostaje bez zmian.
+namespace p10 {
+using p4::scheduler;
+using p4::waiter;
+
+// Element asynchronicznego stosu, przechowywany w promise zadania.
+struct async_frame {
+  const char *name_;
+  const async_frame *parent_ = nullptr;
+};
+
+// Zadanie wykonywane aktualnie na danym wątku. Czytane również przez
+// procedurę obsługi sygnału na tym samym wątku, stąd std::atomic (operacje
+// relaxed są tu wystarczające i bezpieczne w procedurze obsługi sygnału).
+inline thread_local std::atomic<const async_frame *> current_frame = nullptr;
+
+// Zwraca awaiter dla wyrażenia `co_await a` z pominięciem await_transform.
+template <typename A> decltype(auto) get_awaiter(A &&a) {
+  if constexpr (requires { std::forward<A>(a).operator co_await(); })
+    return std::forward<A>(a).operator co_await();
+  else
+    return std::forward<A>(a);
+}
+
+// Opakowanie dowolnego awaitera, które po wznowieniu coroutine ustawia
+// current_frame, a po jej zawieszeniu je czyści.
+template <typename Awaiter> struct traced_awaiter {
+  Awaiter a_;
+  const async_frame *frame_;
+
+  bool await_ready() { return a_.await_ready(); }
+
+  template <typename Promise>
+  auto await_suspend(std::coroutine_handle<Promise> h) {
+    // UWAGA: po a_.await_suspend(h) coroutine mogła już zostać wznowiona na
+    // innym wątku, więc nie wolno dotykać this. current_frame jest jednak
+    // zmienną bieżącego wątku.
+    using result = decltype(a_.await_suspend(h));
+    if constexpr (std::is_void_v<result>) {
+      a_.await_suspend(h);
+      current_frame.store(nullptr, std::memory_order_relaxed);
+    } else {
+      result r = a_.await_suspend(h);
+      current_frame.store(nullptr, std::memory_order_relaxed);
+      return r;
+    }
+  }
+
+  decltype(auto) await_resume() {
+    current_frame.store(frame_, std::memory_order_relaxed);
+    return a_.await_resume();
+  }
+};
+
+// Odpowiednik p4::task z asynchronicznym stosem. Nazwa zadania to nazwa
+// funkcji coroutine pobrana ze std::source_location w konstruktorze promise.
+struct traced_task {
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type {
+    scheduler *sched_ = nullptr;
+    std::coroutine_handle<> continuation_;
+    std::exception_ptr exception_;
+    waiter node_;
+    async_frame frame_;
+
+    promise_type(std::source_location loc = std::source_location::current())
+        : frame_{loc.function_name()} {}
+
+    traced_task get_return_object() {
+      return {handle_type::from_promise(*this)};
+    }
+
+    struct initial_awaiter : std::suspend_always {
+      const async_frame *frame_;
+      void await_resume() noexcept {
+        current_frame.store(frame_, std::memory_order_relaxed);
+      }
+    };
+    initial_awaiter initial_suspend() noexcept { return {{}, &frame_}; }
+
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(handle_type h) noexcept {
+        auto &p = h.promise();
+        current_frame.store(p.frame_.parent_, std::memory_order_relaxed);
+        if (p.continuation_)
+          return p.continuation_;
+        if (p.sched_)
+          p.sched_->task_done();
+        return std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception_ = std::current_exception(); }
+    void return_void() {}
+
+    template <typename A> auto await_transform(A &&a) {
+      using awaiter = std::remove_cvref_t<decltype(get_awaiter(
+          std::forward<A>(a)))>;
+      return traced_awaiter<awaiter>{get_awaiter(std::forward<A>(a)),
+                                     &frame_};
+    }
+  };
+
+  handle_type h_;
+
+  traced_task(handle_type h) : h_(h) {}
+  traced_task(traced_task &&other) noexcept
+      : h_(std::exchange(other.h_, {})) {}
+  ~traced_task() {
+    if (h_)
+      h_.destroy();
+  }
+
+  struct awaiter {
+    handle_type h_;
+    bool await_ready() { return h_.done(); }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> cont) {
+      // Rodzicem zadania jest oczekująca coroutine, o ile również jest
+      // śledzona.
+      if constexpr (std::is_same_v<Promise, promise_type>)
+        h_.promise().frame_.parent_ = &cont.promise().frame_;
+      h_.promise().continuation_ = cont;
+      return h_;
+    }
+    void await_resume() {
+      if (h_.promise().exception_)
+        std::rethrow_exception(h_.promise().exception_);
+    }
+  };
+  awaiter operator co_await() { return {h_}; }
+};
+
+// Profiler próbkujący co interval czasu procesora (ITIMER_PROF). Procedura
+// obsługi sygnału nie alokuje pamięci ani nie zajmuje blokad - zapisuje
+// jedynie wskaźniki na nazwy do bufora o stałym rozmiarze. stop() przywraca
+// obsługę SIGPROF sprzed start().
+class sampler {
+public:
+  static constexpr std::size_t max_depth = 32;
+  static constexpr std::size_t capacity = 1 << 14;
+
+  static void start(std::chrono::microseconds interval) {
+    next_.store(0, std::memory_order_relaxed);
+    struct sigaction sa = {};
+    sa.sa_handler = on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, &previous_);
+    itimerval timer = {};
+    timer.it_interval.tv_sec = interval.count() / 1000000;
+    timer.it_interval.tv_usec = interval.count() % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+  }
+
+  static void stop() {
+    // Po wyłączeniu zegara odbieramy zaległy SIGPROF, zanim przywrócimy
+    // poprzednią obsługę - domyślna zakończyłaby proces.
+    sigset_t prof, mask;
+    sigemptyset(&prof);
+    sigaddset(&prof, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &prof, &mask);
+    itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    timespec no_wait = {};
+    while (sigtimedwait(&prof, nullptr, &no_wait) == SIGPROF) {
+    }
+    sigaction(SIGPROF, &previous_, nullptr);
+    pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+  }
+
+  // Zwraca zebrane próbki w formacie 'folded stacks': każdy wiersz to stos od
+  // najbardziej zewnętrznego zadania, oddzielony średnikami, i liczba próbek.
+  static std::map<std::string, std::size_t> folded() {
+    std::map<std::string, std::size_t> stacks;
+    std::size_t n = std::min(next_.load(std::memory_order_acquire), capacity);
+    for (std::size_t i = 0; i < n; i++) {
+      auto &s = samples_[i];
+      std::string line;
+      for (std::size_t d = s.depth_; d-- > 0;) {
+        line += short_name(s.stack_[d]);
+        if (d)
+          line += ';';
+      }
+      stacks[line.empty() ? "[no task]" : line]++;
+    }
+    return stacks;
+  }
+
+private:
+  struct sample {
+    std::array<const char *, max_depth> stack_;
+    std::size_t depth_;
+  };
+
+  static void on_signal(int) {
+    std::size_t i = next_.fetch_add(1, std::memory_order_relaxed);
+    if (i >= capacity)
+      return;
+    auto &s = samples_[i];
+    s.depth_ = 0;
+    for (auto f = current_frame.load(std::memory_order_relaxed);
+         f && s.depth_ < max_depth; f = f->parent_)
+      s.stack_[s.depth_++] = f->name_;
+  }
+
+  // "p10::traced_task p10::leaf(std::size_t)" -> "p10::leaf"
+  static std::string_view short_name(std::string_view name) {
+    name = name.substr(0, name.find('('));
+    if (auto space = name.rfind(' '); space != std::string_view::npos)
+      name.remove_prefix(space + 1);
+    return name;
+  }
+
+  static inline std::atomic<std::size_t> next_ = 0;
+  static inline std::array<sample, capacity> samples_;
+  static inline struct sigaction previous_ = {};
+};
+
+// Obciążenie procesora, którego kompilator nie może pominąć.
+inline std::size_t spin(std::size_t iterations) {
+  volatile std::size_t sink = 0;
+  for (std::size_t i = 0; i < iterations; i++)
+    sink = sink + i;
+  return sink;
+}
+
+traced_task parse(std::size_t work) {
+  spin(work);
+  co_return;
+}
+
+traced_task compress(std::size_t work) {
+  spin(work);
+  co_return;
+}
+
+traced_task handle_request(scheduler &sched, std::size_t work) {
+  co_await parse(work);
+  co_await sched.yield();
+  co_await compress(3 * work);
+}
+
+traced_task serve(scheduler &sched, std::size_t requests) {
+  for (std::size_t i = 0; i < requests; i++)
+    co_await handle_request(sched, 100000);
+}
+
+auto main() -> void {
+  scheduler sched;
+  traced_task t = serve(sched, 1000);
+  sched.spawn(t);
+
+  sampler::start(std::chrono::microseconds(1000));
+  sched.run();
+  sampler::stop();
+
+  for (auto &[stack, count] : sampler::folded())
+    std::cout << stack << " " << count << std::endl;
+}
+} // namespace p10
+
+// 11. Przykład - strażnik (watchdog) wykrywający coroutines, które zbyt długo
+// wykonują się bez zawieszenia.
+//
+// Planista z p4 jest kooperacyjny: coroutine, która liczy coś długo bez
+// co_await, blokuje cały wątek roboczy. Strażnik co pewien czas sprawdza
+// publikowany przez wątki czas ostatniego wznowienia i zgłasza każde
+// wznowienie trwające dłużej niż zadany próg.
+namespace p11 {
+using p4::scheduler;
+
+struct stall {
+  std::size_t worker_;
+  void *coroutine_;
+  std::chrono::nanoseconds running_for_;
+};
+
+class stall_watchdog {
+public:
+  // Opis coroutine na podstawie adresu ramki (np. nazwa z rejestru ramek).
+  using describe_fn = std::function<std::string(void *)>;
+
+  stall_watchdog(scheduler &sched, std::chrono::nanoseconds threshold,
+                 describe_fn describe = {})
+      : sched_(sched), threshold_(threshold), describe_(std::move(describe)),
+        thread_([this](std::stop_token stop) { watch(stop); }) {
+    sched_.track_resumes(true);
+  }
+
+  ~stall_watchdog() {
+    thread_.request_stop();
+    thread_.join();
+    sched_.track_resumes(false);
+  }
+
+  std::size_t reported() const {
+    return reported_.load(std::memory_order_relaxed);
+  }
+
+private:
+  void watch(std::stop_token stop) {
+    // Każde wznowienie zgłaszamy co najwyżej raz.
+    std::array<std::int64_t, scheduler::max_workers> last_reported{};
+    std::mutex m;
+    std::condition_variable_any cv;
+    std::unique_lock lock(m);
+    for (;;) {
+      // Czekamy do następnego sprawdzenia lub do zatrzymania strażnika.
+      cv.wait_for(lock, stop, threshold_ / 4, [] { return false; });
+      if (stop.stop_requested())
+        return;
+      auto now = scheduler::now_ns();
+      for (std::size_t i = 0; i < scheduler::max_workers; i++) {
+        // Odczyt trafiający na zapis pomijamy - wątek właśnie wznawia
+        // coroutine, więc nie stoi.
+        auto state = sched_.worker(i).read();
+        if (!state)
+          continue;
+        auto resumed_at = state->resumed_at_;
+        if (resumed_at == 0 || resumed_at == last_reported[i] ||
+            now - resumed_at < threshold_.count())
+          continue;
+        last_reported[i] = resumed_at;
+        reported_.fetch_add(1, std::memory_order_relaxed);
+        report({i, state->running_,
+                std::chrono::nanoseconds(now - resumed_at)});
+      }
+    }
+  }
+
+  void report(const stall &s) {
+    std::ostringstream out;
+    out << "watchdog: worker " << s.worker_ << " stalled for >= "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(
+               s.running_for_)
+               .count()
+        << " ms in ";
+    if (describe_)
+      out << describe_(s.coroutine_);
+    else
+      out << "coroutine " << s.coroutine_;
+    std::cerr << out.str() << std::endl;
+  }
+
+  scheduler &sched_;
+  std::chrono::nanoseconds threshold_;
+  describe_fn describe_;
+  std::atomic<std::size_t> reported_ = 0;
+  std::jthread thread_;
+};
+
+p4::task well_behaved(scheduler &sched, std::size_t steps) {
+  for (std::size_t i = 0; i < steps; i++) {
+    p10::spin(10000);
+    co_await sched.yield();
+  }
+}
+
+p4::task hog(std::chrono::milliseconds duration) {
+  auto end = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < end)
+    p10::spin(1000);
+  co_return;
+}
+
+auto main() -> void {
+  scheduler sched;
+  p4::task tasks[] = {well_behaved(sched, 1000),
+                      hog(std::chrono::milliseconds(200))};
+  std::map<void *, std::string> names = {
+      {tasks[0].h_.address(), "well_behaved"}, {tasks[1].h_.address(), "hog"}};
+
+  std::size_t reported;
+  {
+    stall_watchdog watchdog(sched, std::chrono::milliseconds(50),
+                            [&](void *coroutine) { return names[coroutine]; });
+    for (auto &t : tasks)
+      sched.spawn(t);
+    sched.run(2);
+    reported = watchdog.reported();
+  }
+  std::cout << "main: stalls reported: " << reported << std::endl;
+}
+} // namespace p11
+
+// 12. Przykład - wykrywanie wycieków ramek coroutines.
+//
+// W p1 i p2 ramkę trzeba zniszczyć ręcznie przez h.destroy() - jeżeli się o
+// tym zapomni, pamięć cicho wycieka. Tutaj promise alokuje ramkę przez
+// własny operator new, który zapisuje ją w rejestrze żywych ramek, a operator
+// delete ją z niego usuwa. Przy zakończeniu programu rejestr wypisuje ramki,
+// które nie zostały zniszczone.
+//
+// Rejestr jest bez blokad: to zbiór tablic z adresowaniem otwartym
+// (podzielony na niezależne części - 'shardy'), w którym wstawienie i
+// usunięcie to kilka operacji compare_exchange. Dzięki temu może pozostać
+// włączony również poza środowiskiem deweloperskim.
+namespace p12 {
+
+class frame_registry {
+public:
+  static constexpr std::size_t shards = 16;
+  static constexpr std::size_t slots_per_shard = 4096;
+
+  // Przy zakończeniu programu zgłaszamy ramki, które nie zostały zniszczone.
+  ~frame_registry() {
+    if (live() > 0)
+      report(std::cerr);
+  }
+
+  // Ramka trafia do pierwszego wolnego albo usuniętego (tombstone) slotu na
+  // ścieżce próbkowania, więc zwolnione sloty są używane ponownie i przy
+  // stałej liczbie żywych ramek rejestr się nie zapełnia.
+  void insert(void *frame, std::size_t size) {
+    auto &s = shard_of(frame);
+    for (std::size_t i = 0, at = start_of(frame); i < slots_per_shard;
+         i++, at = (at + 1) % slots_per_shard) {
+      auto &slot = s.slots_[at];
+      void *key = slot.frame_.load(std::memory_order_relaxed);
+      if ((key == nullptr || key == tombstone()) &&
+          slot.frame_.compare_exchange_strong(key, frame,
+                                              std::memory_order_acq_rel)) {
+        slot.size_.store(size, std::memory_order_relaxed);
+        slot.function_.store(nullptr, std::memory_order_release);
+        s.live_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+    // Brak miejsca - ramka nie będzie śledzona.
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void erase(void *frame) {
+    if (auto *slot = find(frame)) {
+      slot->frame_.store(tombstone(), std::memory_order_release);
+      shard_of(frame).live_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Zapamiętuje miejsce utworzenia ramki (wołane z konstruktora promise).
+  // Kopiujemy pola std::source_location - nazwy to statyczne napisy, więc
+  // opis pozostaje ważny także po zniszczeniu ramki.
+  void describe(void *frame, const std::source_location &site) {
+    if (auto *slot = find(frame)) {
+      slot->file_.store(site.file_name(), std::memory_order_relaxed);
+      slot->line_.store(site.line(), std::memory_order_relaxed);
+      slot->function_.store(site.function_name(), std::memory_order_release);
+    }
+  }
+
+  // Opis żywej ramki, np. do raportów strażnika z p11.
+  std::string describe(void *frame) const {
+    std::ostringstream out;
+    if (auto *slot = const_cast<frame_registry *>(this)->find(frame)) {
+      out << site_of(*slot);
+      out << " (" << slot->size_.load(std::memory_order_relaxed)
+          << " bytes)";
+    } else {
+      out << "coroutine " << frame;
+    }
+    return out.str();
+  }
+
+  std::size_t live() const {
+    std::size_t n = 0;
+    for (auto &s : shards_)
+      n += s.live_.load(std::memory_order_relaxed);
+    return n;
+  }
+
+  // Wypisuje żywe ramki pogrupowane według miejsca utworzenia.
+  void report(std::ostream &out) const {
+    struct group {
+      std::size_t frames_ = 0;
+      std::size_t bytes_ = 0;
+    };
+    std::map<std::string, group> groups;
+    for (auto &s : shards_)
+      for (auto &slot : s.slots_) {
+        void *key = slot.frame_.load(std::memory_order_acquire);
+        if (key == nullptr || key == tombstone())
+          continue;
+        auto &g = groups[site_of(slot)];
+        g.frames_++;
+        g.bytes_ += slot.size_.load(std::memory_order_relaxed);
+      }
+    out << "frame registry: " << live() << " live frame(s)";
+    if (auto dropped = dropped_.load(std::memory_order_relaxed))
+      out << ", " << dropped << " untracked";
+    out << std::endl;
+    for (auto &[site, g] : groups)
+      out << "  " << g.frames_ << " frame(s), " << g.bytes_ << " bytes: "
+          << site << std::endl;
+  }
+
+private:
+  struct slot {
+    std::atomic<void *> frame_ = nullptr;
+    std::atomic<std::size_t> size_ = 0;
+    std::atomic<const char *> function_ = nullptr;
+    std::atomic<const char *> file_ = nullptr;
+    std::atomic<std::uint_least32_t> line_ = 0;
+  };
+
+  // Slot mógł w międzyczasie przejść do innej ramki - wtedy opis może
+  // mieszać pola obu, ale zawsze wskazuje na poprawne napisy.
+  static std::string site_of(const slot &s) {
+    const char *function = s.function_.load(std::memory_order_acquire);
+    if (!function)
+      return "<unknown site>";
+    return std::string(function) + " at " +
+           s.file_.load(std::memory_order_relaxed) + ":" +
+           std::to_string(s.line_.load(std::memory_order_relaxed));
+  }
+
+  struct alignas(p5::cache_line) shard {
+    std::atomic<std::size_t> live_ = 0;
+    std::array<slot, slots_per_shard> slots_;
+  };
+
+  // Oznaczenie usuniętego wpisu - wolnego do ponownego użycia, ale nie
+  // przerywającego przeszukiwania (inaczej nie znaleźlibyśmy wpisów
+  // wstawionych za nim).
+  static void *tombstone() { return reinterpret_cast<void *>(1); }
+
+  static std::size_t hash(void *frame) {
+    auto x = reinterpret_cast<std::uintptr_t>(frame);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+  }
+  shard &shard_of(void *frame) { return shards_[hash(frame) % shards]; }
+  static std::size_t start_of(void *frame) {
+    return hash(frame) / shards % slots_per_shard;
+  }
+
+  slot *find(void *frame) {
+    auto &s = shard_of(frame);
+    for (std::size_t i = 0, at = start_of(frame); i < slots_per_shard;
+         i++, at = (at + 1) % slots_per_shard) {
+      void *key = s.slots_[at].frame_.load(std::memory_order_acquire);
+      if (key == frame)
+        return &s.slots_[at];
+      if (key == nullptr)
+        return nullptr;
+    }
+    return nullptr;
+  }
+
+  std::array<shard, shards> shards_;
+  std::atomic<std::size_t> dropped_ = 0;
+};
+
+inline frame_registry registry;
+
+// Klasa bazowa promise_type (wzorzec CRTP) rejestrująca ramkę. Promise musi
+// przekazać miejsce utworzenia z własnego konstruktora - tylko tam domyślny
+// argument std::source_location::current() wskazuje na funkcję coroutine.
+template <typename Promise> struct tracked_frame {
+  explicit tracked_frame(const std::source_location &site) {
+    auto h = std::coroutine_handle<Promise>::from_promise(
+        static_cast<Promise &>(*this));
+    registry.describe(h.address(), site);
+  }
+
+  static void *operator new(std::size_t size) {
+    void *frame = ::operator new(size);
+    registry.insert(frame, size);
+    return frame;
+  }
+  static void operator delete(void *frame) noexcept {
+    registry.erase(frame);
+    ::operator delete(frame);
+  }
+};
+
+// Odpowiednik p1::coroutine ze śledzoną ramką.
+struct promise;
+
+struct coroutine : std::coroutine_handle<promise> {
+  using promise_type = p12::promise;
+};
+
+struct promise : tracked_frame<promise> {
+  promise(std::source_location site = std::source_location::current())
+      : tracked_frame(site) {}
+
+  coroutine get_return_object() { return {coroutine::from_promise(*this)}; }
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  std::suspend_always final_suspend() noexcept { return {}; }
+  void return_void() {}
+  void unhandled_exception() {}
+};
+
+coroutine ticker(std::size_t steps) {
+  for (std::size_t i = 0; i < steps; i++)
+    co_await std::suspend_always();
+}
+
+auto main() -> void {
+  auto a = ticker(1);
+  auto b = ticker(2);
+  auto c = ticker(3);
+  a.destroy();
+  b.destroy();
+  // Zapomnieliśmy o c.destroy() - rejestr to wykryje.
+  registry.report(std::cout);
+  c.destroy();
+  // Wielokrotnie więcej ramek niż slotów - zwolnione sloty są używane
+  // ponownie, więc żadna ramka nie zostaje bez śledzenia.
+  for (std::size_t i = 0; i < 4 * frame_registry::shards *
+                                  frame_registry::slots_per_shard;
+       i++)
+    ticker(1).destroy();
+  registry.report(std::cout);
+}
+} // namespace p12
+
+// 13. Przykład - histogramy opóźnień wznowień coroutines.
+//
+// Średni czas ukrywa opóźnienia w ogonie rozkładu. Dla każdej funkcji
+// coroutine zbieramy dwa histogramy:
+// * czas wykonania od wznowienia do kolejnego zawieszenia ('slice'),
+// * czas od zawieszenia do kolejnego wznowienia ('await').
+//
+// Histogramy mają kubełki rosnące logarytmicznie (jak HDR Histogram): każda
+// potęga dwójki jest podzielona na 2^(Precision - 1) równych części, więc
+// błąd względny nie przekracza 2^-(Precision - 1). Każdy wątek zapisuje do
+// własnych histogramów bez blokad, a eksport sumuje je wszystkie.
+namespace p13 {
+
+template <unsigned Precision = 6> class log_histogram {
+public:
+  static constexpr std::size_t sub = std::size_t(1) << Precision;
+  static constexpr std::size_t half = sub / 2;
+  static constexpr std::size_t buckets = sub + (64 - Precision) * half;
+
+  static std::size_t index(std::uint64_t v) {
+    if (v < sub)
+      return v;
+    unsigned shift = std::bit_width(v) - Precision;
+    return sub + (shift - 1) * half + ((v >> shift) - half);
+  }
+
+  // Największa wartość należąca do kubełka i.
+  static std::uint64_t highest(std::size_t i) {
+    if (i < sub)
+      return i;
+    std::size_t k = i - sub;
+    unsigned shift = unsigned(k / half) + 1;
+    std::uint64_t mantissa = half + k % half;
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+  // Zapis wykonuje tylko wątek-właściciel, więc zamiast fetch_add wystarczy
+  // odczyt i zapis relaxed - inne wątki mogą w tym czasie bezpiecznie czytać.
+  void record(std::uint64_t v) {
+    auto &c = counts_[index(v)];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  void add_to(std::array<std::uint64_t, buckets> &sum) const {
+    for (std::size_t i = 0; i < buckets; i++)
+      sum[i] += counts_[i].load(std::memory_order_relaxed);
+  }
+
+private:
+  std::array<std::atomic<std::uint64_t>, buckets> counts_{};
+};
+
+using histogram = log_histogram<>;
+
+// Rejestr funkcji coroutine. Kluczem jest wskaźnik na nazwę ze
+// std::source_location (stały napis), a identyfikatorem - numer miejsca w
+// tablicy, zajmowanego jednym compare_exchange.
+class site_table {
+public:
+  static constexpr std::size_t capacity = 256;
+
+  std::size_t id(const char *name) {
+    std::size_t start = std::hash<const void *>{}(name) % capacity;
+    for (std::size_t i = 0; i < capacity; i++) {
+      std::size_t at = (start + i) % capacity;
+      const char *key = names_[at].load(std::memory_order_acquire);
+      if (key == nullptr && names_[at].compare_exchange_strong(
+                                key, name, std::memory_order_acq_rel))
+        return at;
+      // Po nieudanym compare_exchange key zawiera wartość wstawioną przez
+      // inny wątek - być może tę samą nazwę.
+      if (key == name)
+        return at;
+    }
+    throw std::length_error("site_table: too many coroutine functions");
+  }
+
+  const char *name(std::size_t id) const {
+    return names_[id].load(std::memory_order_acquire);
+  }
+
+private:
+  std::array<std::atomic<const char *>, capacity> names_{};
+};
+
+inline site_table sites;
+
+// Histogramy jednego wątku. Bufory wszystkich wątków tworzą listę, do której
+// wątek dołącza się raz (bez blokady) i która żyje do końca programu, aby
+// eksport uwzględniał również wątki już zakończone.
+struct thread_buffer {
+  struct site_histograms {
+    histogram slice_;
+    histogram await_;
+  };
+
+  std::array<std::atomic<site_histograms *>, site_table::capacity> sites_{};
+  thread_buffer *next_ = nullptr;
+
+  site_histograms &at(std::size_t site) {
+    auto *h = sites_[site].load(std::memory_order_relaxed);
+    if (!h) {
+      h = new site_histograms;
+      sites_[site].store(h, std::memory_order_release);
+    }
+    return *h;
+  }
+};
+
+inline std::atomic<thread_buffer *> buffers = nullptr;
+
+inline thread_buffer &local_buffer() {
+  static thread_local thread_buffer *buffer = [] {
+    auto *b = new thread_buffer;
+    b->next_ = buffers.load(std::memory_order_relaxed);
+    while (!buffers.compare_exchange_weak(b->next_, b,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed))
+      ;
+    return b;
+  }();
+  return *buffer;
+}
+
+// Klasa bazowa promise p3::Generator (parametr Frame) mierząca czasy
+// wznowień i zawieszeń.
+class timed_frame {
+public:
+  timed_frame(std::source_location site)
+      : site_(sites.id(site.function_name())) {}
+
+  void on_resume() {
+    auto now = p4::scheduler::now_ns();
+    if (suspended_at_)
+      local_buffer().at(site_).await_.record(now - suspended_at_);
+    resumed_at_ = now;
+  }
+
+  void on_suspend() {
+    auto now = p4::scheduler::now_ns();
+    local_buffer().at(site_).slice_.record(now - resumed_at_);
+    suspended_at_ = now;
+  }
+
+private:
+  std::size_t site_;
+  std::int64_t resumed_at_ = 0;
+  std::int64_t suspended_at_ = 0;
+};
+
+template <typename T> using TimedGenerator = p3::Generator<T, timed_frame>;
+
+// Sumuje histogramy wszystkich wątków i wypisuje percentyle (w ns).
+inline void report(std::ostream &out) {
+  using counts = std::array<std::uint64_t, histogram::buckets>;
+  auto percentiles = [&](const char *kind, const counts &c) {
+    std::uint64_t total = 0;
+    for (auto n : c)
+      total += n;
+    out << "  " << kind << ": n=" << total;
+    if (total == 0) {
+      out << std::endl;
+      return;
+    }
+    for (double p : {0.5, 0.9, 0.99, 0.999, 1.0}) {
+      auto target = std::max<std::uint64_t>(1, std::uint64_t(p * total));
+      std::uint64_t seen = 0;
+      std::size_t i = 0;
+      while ((seen += c[i]) < target)
+        i++;
+      out << " p" << p * 100 << "=" << histogram::highest(i);
+    }
+    out << std::endl;
+  };
+
+  for (std::size_t site = 0; site < site_table::capacity; site++) {
+    const char *name = sites.name(site);
+    if (!name)
+      continue;
+    counts slice{}, await{};
+    for (auto *b = buffers.load(std::memory_order_acquire); b; b = b->next_)
+      if (auto *h = b->sites_[site].load(std::memory_order_acquire)) {
+        h->slice_.add_to(slice);
+        h->await_.add_to(await);
+      }
+    out << name << std::endl;
+    percentiles("slice", slice);
+    percentiles("await", await);
+  }
+}
+
+// Generator, którego co setny element jest znacznie droższy.
+TimedGenerator<std::size_t> spiky_counter(std::size_t max) {
+  for (std::size_t i = 0; i < max; i++) {
+    p10::spin(i % 100 == 0 ? 20000 : 200);
+    co_yield i;
+  }
+}
+
+TimedGenerator<std::size_t> steady_counter(std::size_t max) {
+  for (std::size_t i = 0; i < max; i++) {
+    p10::spin(500);
+    co_yield i;
+  }
+}
+
+auto main() -> void {
+  // Konsumujemy generatory jednocześnie na dwóch wątkach - każdy zapisuje do
+  // własnych histogramów, łączonych dopiero przy eksporcie.
+  std::size_t sum = 0, other_sum = 0;
+  std::thread other([&other_sum] {
+    auto gen = steady_counter(20000);
+    while (gen)
+      other_sum += gen();
+  });
+  auto gen = spiky_counter(20000);
+  while (gen)
+    sum += gen();
+  other.join();
+  sum += other_sum;
+  report(std::cout);
+  std::cout << "main: sum " << sum << std::endl;
+}
+} // namespace p13
+
+// 14. Przykład - liczniki sprzętowe procesora w benchmarkach.
+//
+// Sam czas na operację nie mówi, czy ścieżkę wznowienia w
+// p3::Generator::fill() ogranicza źle przewidziany skok, brak instrukcji w
+// pamięci podręcznej, czy alokacja. Linux udostępnia liczniki sprzętowe przez
+// wywołanie systemowe perf_event_open. Jeżeli liczniki są niedostępne (brak
+// uprawnień, maszyna wirtualna), benchmark działa dalej i wypisuje "n/a".
+namespace p14 {
+
+// Kodowanie zdarzenia 'chybienie przy odczycie' dla danej pamięci podręcznej.
+constexpr std::uint64_t cache_read_miss(std::uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+class perf_counters {
+public:
+  struct event {
+    const char *name_;
+    std::uint32_t type_;
+    std::uint64_t config_;
+  };
+
+  static constexpr std::array<event, 5> events = {{
+      {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+      {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+      {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+      {"L1d-misses", PERF_TYPE_HW_CACHE,
+       cache_read_miss(PERF_COUNT_HW_CACHE_L1D)},
+      {"L1i-misses", PERF_TYPE_HW_CACHE,
+       cache_read_miss(PERF_COUNT_HW_CACHE_L1I)},
+  }};
+
+  // Każde zdarzenie otwieramy osobno (nie jako grupę), aby brak jednego z
+  // nich nie wyłączał pozostałych.
+  perf_counters() {
+    for (std::size_t i = 0; i < events.size(); i++) {
+      perf_event_attr attr = {};
+      attr.size = sizeof(attr);
+      attr.type = events[i].type_;
+      attr.config = events[i].config_;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.inherit = 1;
+      attr.read_format =
+          PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fds_[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+  }
+
+  perf_counters(const perf_counters &) = delete;
+  perf_counters &operator=(const perf_counters &) = delete;
+
+  ~perf_counters() {
+    for (int fd : fds_)
+      if (fd >= 0)
+        close(fd);
+  }
+
+  void start() {
+    for (int fd : fds_)
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+  }
+
+  void stop() {
+    for (int fd : fds_)
+      if (fd >= 0)
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+
+  // Wartość licznika i albo std::nullopt, jeżeli jest niedostępny. Gdy jądro
+  // współdzieli liczniki między zdarzeniami (multipleksowanie), wynik jest
+  // skalowany do całego czasu pomiaru.
+  std::optional<double> value(std::size_t i) const {
+    struct {
+      std::uint64_t value_, enabled_, running_;
+    } data;
+    if (fds_[i] < 0 || read(fds_[i], &data, sizeof(data)) != sizeof(data) ||
+        data.running_ == 0)
+      return std::nullopt;
+    return double(data.value_) * double(data.enabled_) /
+           double(data.running_);
+  }
+
+private:
+  std::array<int, events.size()> fds_;
+};
+
+// Wykonuje fn(iterations) i wypisuje czas, alokacje oraz liczniki sprzętowe
+// w przeliczeniu na jedną iterację.
+template <typename Fn>
+void benchmark(const std::string &name, std::size_t iterations, Fn fn) {
+  perf_counters counters;
+  p8::counting_scope counting;
+  auto before = p8::alloc_snapshot{};
+  counters.start();
+  auto start = std::chrono::steady_clock::now();
+  fn(iterations);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  counters.stop();
+  auto allocs = p8::alloc_snapshot{} - before;
+
+  auto per_op = [&](double v) { return v / double(iterations); };
+  std::cout << name << ": "
+            << per_op(std::chrono::duration<double, std::nano>(elapsed).count())
+            << " ns/op, " << per_op(double(allocs.allocations_))
+            << " allocs/op";
+  for (std::size_t i = 0; i < perf_counters::events.size(); i++) {
+    std::cout << ", " << perf_counters::events[i].name_ << " ";
+    if (auto v = counters.value(i))
+      std::cout << per_op(*v);
+    else
+      std::cout << "n/a";
+  }
+  std::cout << std::endl;
+}
+
+auto main() -> void {
+  constexpr std::size_t n = 1000000;
+  std::size_t sum = 0;
+  benchmark("p3::Generator resume", n, [&](std::size_t iterations) {
+    auto gen = p9::counter(iterations);
+    while (gen)
+      sum += gen();
+  });
+  benchmark("p3::Generator create+resume", n, [&](std::size_t iterations) {
+    for (std::size_t i = 0; i < iterations; i++) {
+      auto gen = p9::counter(1);
+      while (gen)
+        sum += gen();
+    }
+  });
+  benchmark("SlimGenerator resume", n, [&](std::size_t iterations) {
+    auto gen = p8::slim_counter(iterations);
+    while (gen)
+      sum += gen();
+  });
+  std::cout << "main: sum " << sum << std::endl;
+}
+} // namespace p14
+
+// 15. Przykład - p3::Generator jako zakres wejściowy.
+//
+// p3::Generator jest zakresem wejściowym (input_range), więc konsument
+// napisany względem konceptu generator_of poniżej przyjmie go tak samo jak
+// inne zakresy. Ponadto from_range() opakowuje dowolny zakres wejściowy w
+// p3::Generator - tam, gdzie wymagany jest konkretny typ. Pomiar poniżej
+// pokazuje jedynie koszt tego opakowania (p3::Generator bezpośrednio i przez
+// from_range).
+//
+// Porównanie ze std::generator jest odłożone: używana biblioteka standardowa
+// (GCC 12) nie ma <generator>, więc takiego kodu nie da się tu skompilować ani
+// zmierzyć. Typy nie są też wymienne - reference w p3::Generator to T &, a w
+// std::generator<T> to T &&, więc konsument zależny od typu referencji
+// zachowa się inaczej. Koncept generator_of wymaga tylko konwersji do T,
+// dlatego sum() przyjmie oba.
+namespace p15 {
+
+template <typename R, typename T>
+concept generator_of =
+    std::ranges::input_range<R> &&
+    std::convertible_to<std::ranges::range_reference_t<R>, T>;
+
+template <std::ranges::input_range R>
+p3::Generator<std::ranges::range_value_t<R>> from_range(R range) {
+  for (auto &&v : range)
+    co_yield std::forward<decltype(v)>(v);
+}
+
+// Konsument niezależny od typu generatora.
+template <generator_of<std::size_t> R> std::size_t sum(R &&range) {
+  std::size_t s = 0;
+  for (std::size_t v : range)
+    s += v;
+  return s;
+}
+
+// Rozmiar ramki: bajty zaalokowane przy utworzeniu jednej coroutine.
+template <typename Make> std::size_t frame_bytes(Make make) {
+  p8::counting_scope counting;
+  auto before = p8::alloc_snapshot{};
+  auto gen = make();
+  return (p8::alloc_snapshot{} - before).bytes_;
+}
+
+auto main() -> void {
+  std::cout << "main: sum of p3::Generator: " << sum(p9::counter(10))
+            << std::endl;
+  std::cout << "main: first 3 squares:";
+  for (auto v : p9::counter(10) |
+                    std::views::transform([](std::size_t x) { return x * x; }) |
+                    std::views::take(3))
+    std::cout << " " << v;
+  std::cout << std::endl;
+
+  constexpr std::size_t n = 1000000;
+  std::size_t total = 0;
+  std::cout << "main: p3::Generator frame: "
+            << frame_bytes([] { return p9::counter(1); }) << " bytes"
+            << std::endl;
+  p14::benchmark("p3::Generator range-for", n,
+                 [&](std::size_t iterations) {
+                   total += sum(p9::counter(iterations));
+                 });
+  p14::benchmark("p3::Generator via from_range", n,
+                 [&](std::size_t iterations) {
+                   total += sum(from_range(p9::counter(iterations)));
+                 });
+  std::cout << "main: total " << total << std::endl;
+}
+} // namespace p15
+
+// 16. Przykład - leniwy i gorliwy start generatora.
+//
+// p3::Generator<T, Frame, eager_start<K>> uruchamia coroutine już przy
+// utworzeniu, więc konsument wrażliwy na opóźnienia dostaje pierwszą wartość
+// bez czekania na wznowienie (podobnie jak w p2, ale bez ręcznej obsługi).
+namespace p16 {
+using p3::eager_start;
+using p3::Generator;
+using p3::heap_frame;
+
+template <typename Start>
+Generator<std::size_t, heap_frame, Start> counter(std::size_t max) {
+  for (std::size_t i = 0; i < max; i++) {
+    std::cout << "coroutine: generated: " << i << std::endl;
+    co_yield i;
+  }
+}
+
+template <typename Start> void consume(const char *name, std::size_t max) {
+  std::cout << "main: creating " << name << std::endl;
+  auto gen = counter<Start>(max);
+  std::cout << "main: created" << std::endl;
+  while (gen)
+    std::cout << "main: got from coroutine: " << gen() << std::endl;
+}
+
+// Wyjątek w trakcie wyprzedzającego generowania przy utworzeniu - konsument
+// dostaje najpierw wartości wygenerowane przed nim.
+template <typename Start> void consume_faulty(const char *name) {
+  std::cout << "main: creating " << name << std::endl;
+  auto gen = [](std::size_t max) -> Generator<std::size_t, heap_frame, Start> {
+    for (std::size_t i = 0; i < max; i++) {
+      std::cout << "coroutine: generated: " << i << std::endl;
+      co_yield i;
+    }
+    std::cout << "coroutine: throwing exception" << std::endl;
+    throw std::logic_error("coroutine failed");
+  }(2);
+  std::cout << "main: created" << std::endl;
+  try {
+    while (gen)
+      std::cout << "main: got from coroutine: " << gen() << std::endl;
+  } catch (const std::exception &e) {
+    std::cout << "main: exception: " << e.what() << std::endl;
+  }
+}
+
+template <typename Start>
+Generator<std::size_t, heap_frame, Start> quiet_counter(std::size_t max) {
+  for (std::size_t i = 0; i < max; i++)
+    co_yield i;
+}
+
+// Czas odczytu pierwszej wartości z wcześniej utworzonych generatorów - przy
+// eager_start nie wymaga on wznawiania coroutine.
+template <typename Start> void first_value_latency(const char *name) {
+  constexpr std::size_t n = 100000;
+  std::vector<Generator<std::size_t, heap_frame, Start>> gens;
+  gens.reserve(n);
+  for (std::size_t i = 0; i < n; i++)
+    gens.push_back(quiet_counter<Start>(i + 1));
+
+  std::size_t sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (auto &gen : gens)
+    sum += gen();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "main: " << name << ": first value after "
+            << std::chrono::duration<double, std::nano>(elapsed).count() /
+                   double(n)
+            << " ns, sum " << sum << std::endl;
+}
+
+auto main() -> void {
+  consume<p3::lazy_start>("lazy generator", 2);
+  consume<eager_start<>>("eager generator", 2);
+  consume<eager_start<3>>("eager generator with run-ahead of 3", 4);
+  consume_faulty<eager_start<3>>("faulty generator with run-ahead of 3");
+  first_value_latency<p3::lazy_start>("lazy_start");
+  first_value_latency<eager_start<>>("eager_start<1>");
+}
+} // namespace p16
+
+// 17. Przykład - generator bez kontroli w gorącej pętli.
+//
+// p3::Generator<T, Frame, Start, unchecked> kompiluje się do samego
+// wznowienia i odczytu wartości. Domyślny checked pilnuje poprawnej
+// kolejności wywołań i przenosi wyjątki, a w wersji debug dodatkowo wykrywa
+// błędy użycia generatora asercjami.
+namespace p17 {
+using p3::Generator;
+using p3::heap_frame;
+using p3::lazy_start;
+
+template <typename Checks>
+Generator<std::size_t, heap_frame, lazy_start, Checks>
+counter(std::size_t max) {
+  for (std::size_t i = 0; i < max; i++)
+    co_yield i;
+}
+
+template <typename Checks>
+Generator<std::size_t, heap_frame, lazy_start, Checks> faulty(std::size_t max) {
+  for (std::size_t i = 0; i < max; i++)
+    co_yield i;
+  throw std::logic_error("coroutine failed");
+}
+
+auto main() -> void {
+  constexpr std::size_t n = 10000000;
+  std::size_t sum = 0;
+  p14::benchmark("checked generator", n, [&](std::size_t iterations) {
+    auto gen = counter<p3::checked>(iterations);
+    while (gen)
+      sum += gen();
+  });
+  p14::benchmark("unchecked generator", n, [&](std::size_t iterations) {
+    auto gen = counter<p3::unchecked>(iterations);
+    while (gen)
+      sum += gen();
+  });
+  std::cout << "main: sum " << sum << std::endl;
+
+  std::cout << "main: promise sizes: checked "
+            << sizeof(decltype(counter<p3::checked>(0))::promise_type)
+            << " bytes, unchecked "
+            << sizeof(decltype(counter<p3::unchecked>(0))::promise_type)
+            << " bytes" << std::endl;
+
+  // Bez kontroli wyjątek wydostaje się prosto z operator bool.
+  try {
+    auto gen = faulty<p3::unchecked>(2);
+    while (gen)
+      std::cout << "main: got from coroutine: " << gen() << std::endl;
+  } catch (const std::exception &e) {
+    std::cout << "main: exception: " << e.what() << std::endl;
+  }
+}
+} // namespace p17
+
+// 18. Przykład - przeskakiwanie wartości generatora (advance / seek).
+//
+// Konsument, który potrzebuje elementów od pozycji k (np. kolejna strona
+// wyników albo fragment przydzielony danemu wątkowi), musiałby wznowić
+// generator k razy. Generator, który wie, jak wyliczyć dalsze elementy
+// bezpośrednio, deklaruje to w typie (polityka p3::seekable) i odczytuje
+// liczbę elementów do pominięcia z wyniku `co_yield`. Pozostałe generatory
+// nie płacą za tę możliwość ani polem w promise, ani zapisem przy co_yield.
+namespace p18 {
+template <typename T>
+using SeekableGenerator = p3::Generator<T, p3::heap_frame, p3::lazy_start,
+                                        p3::checked, p3::seekable>;
+
+SeekableGenerator<std::size_t> seekable_counter(std::size_t max) {
+  for (std::size_t i = 0; i < max;) {
+    std::size_t skip = co_yield i;
+    i += 1 + skip;
+  }
+}
+
+// Zwraca sumę count elementów zaczynając od pozycji offset.
+template <typename Gen>
+std::size_t page(Gen gen, std::size_t offset, std::size_t count) {
+  gen.advance(offset);
+  std::size_t sum = 0;
+  for (; count > 0 && gen; count--)
+    sum += gen();
+  return sum;
+}
+
+auto main() -> void {
+  auto gen = seekable_counter(100);
+  std::cout << "main: got from coroutine: " << gen() << std::endl;
+  gen.advance(10);
+  std::cout << "main: after advance(10): " << gen() << std::endl;
+  gen.advance(1000);
+  std::cout << "main: after advance(1000): " << (gen ? "more" : "end")
+            << std::endl;
+
+  constexpr std::size_t n = 10000000;
+  std::size_t sum = 0;
+  p14::benchmark("page at offset n, plain counter", 1, [&](std::size_t) {
+    sum += page(p9::counter(n + 10), n, 10);
+  });
+  p14::benchmark("page at offset n, seekable counter", 1, [&](std::size_t) {
+    sum += page(seekable_counter(n + 10), n, 10);
+  });
+  std::cout << "main: sum " << sum << std::endl;
+}
+} // namespace p18
+
+// 19. Przykład - generatory dzielone na części do równoległego przetwarzania.
+//
+// Generator taki jak p3::counter(max) ukrywa, że jego pozostały zakres można
+// łatwo podzielić. Typ spełniający koncept splittable (podobnie jak
+// Spliterator w Javie) opisuje zakres, który potrafi oddać swoją część jako
+// niezależny obiekt, a każdą część zamienić na generator. parallel_for_each i
+// parallel_reduce dzielą zakres rekurencyjnie, ale z góry, na wątku
+// wywołującym - na około 4 części na wątek - a następnie wykonują części jako
+// zadania na wątkach planisty z p4. Planista (i jego wątki) powstaje przy
+// każdym wywołaniu, więc opłaca się to dopiero dla zakresów, których
+// przetwarzanie trwa znacznie dłużej niż utworzenie kilku wątków.
+namespace p19 {
+
+template <typename S>
+concept splittable = std::movable<S> && requires(S s) {
+  // Oddaje początkową część zakresu (zostawiając sobie resztę) albo
+  // std::nullopt, jeżeli dalszy podział nie ma sensu.
+  { s.try_split() } -> std::same_as<std::optional<S>>;
+  // Szacowana liczba pozostałych elementów.
+  { s.size() } -> std::convertible_to<std::size_t>;
+  // Generator elementów zakresu.
+  { s.generate() } -> std::ranges::input_range;
+};
+
+// Odpowiednik p3::counter dla zakresu [begin, end).
+p3::Generator<std::size_t> counter(std::size_t begin, std::size_t end) {
+  for (std::size_t i = begin; i < end; i++)
+    co_yield i;
+}
+
+struct counter_range {
+  std::size_t begin_;
+  std::size_t end_;
+
+  std::optional<counter_range> try_split() {
+    if (size() < 2)
+      return std::nullopt;
+    std::size_t mid = begin_ + size() / 2;
+    return counter_range{std::exchange(begin_, mid), mid};
+  }
+  std::size_t size() const { return end_ - begin_; }
+  p3::Generator<std::size_t> generate() const { return counter(begin_, end_); }
+};
+
+// Dzieli zakres rekurencyjnie, dopóki części są większe niż grain.
+template <splittable S>
+void split(S s, std::size_t grain, std::vector<S> &pieces) {
+  if (s.size() > grain)
+    if (auto prefix = s.try_split()) {
+      split(std::move(*prefix), grain, pieces);
+      split(std::move(s), grain, pieces);
+      return;
+    }
+  pieces.push_back(std::move(s));
+}
+
+// Domyślnie kilka części na wątek, aby nierówne części się wyrównały.
+template <splittable S>
+std::size_t default_grain(const S &s, std::size_t threads) {
+  return std::max<std::size_t>(1, s.size() / (4 * threads));
+}
+
+template <splittable S, typename F> p4::task for_each_piece(S piece, F &f) {
+  for (auto &&v : piece.generate())
+    f(v);
+  co_return;
+}
+
+// Wywołuje f dla każdego elementu - współbieżnie na threads wątkach, więc f
+// musi być bezpieczna wielowątkowo.
+template <splittable S, typename F>
+void parallel_for_each(S s, F f, std::size_t threads) {
+  std::vector<S> pieces;
+  std::size_t grain = default_grain(s, threads);
+  split(std::move(s), grain, pieces);
+  p4::scheduler sched;
+  std::vector<p4::task> tasks;
+  for (auto &piece : pieces)
+    tasks.push_back(for_each_piece(std::move(piece), f));
+  for (auto &t : tasks)
+    sched.spawn(t);
+  sched.run(threads);
+  for (auto &t : tasks)
+    t.get();
+}
+
+// Wynik części jest zapisywany do out raz, na końcu - sąsiednie elementy
+// wektora wyników dzielą linie pamięci podręcznej, więc zapisy po każdym
+// elemencie z różnych wątków unieważniałyby sobie nawzajem te linie.
+template <splittable S, typename T, typename Op>
+p4::task reduce_piece(S piece, std::optional<T> &out, Op &op) {
+  std::optional<T> acc;
+  for (auto &&v : piece.generate())
+    acc = acc ? op(std::move(*acc), v) : T(v);
+  out = std::move(acc);
+  co_return;
+}
+
+// Redukcja operacją łączną op. Wyniki części są łączone w kolejności
+// zakresu, więc op nie musi być przemienna.
+template <splittable S, typename T, typename Op>
+T parallel_reduce(S s, T init, Op op, std::size_t threads) {
+  std::vector<S> pieces;
+  std::size_t grain = default_grain(s, threads);
+  split(std::move(s), grain, pieces);
+  std::vector<std::optional<T>> partial(pieces.size());
+  p4::scheduler sched;
+  std::vector<p4::task> tasks;
+  for (std::size_t i = 0; i < pieces.size(); i++)
+    tasks.push_back(reduce_piece(std::move(pieces[i]), partial[i], op));
+  for (auto &t : tasks)
+    sched.spawn(t);
+  sched.run(threads);
+  for (std::size_t i = 0; i < tasks.size(); i++) {
+    tasks[i].get();
+    if (partial[i])
+      init = op(std::move(init), std::move(*partial[i]));
+  }
+  return init;
+}
+
+auto main() -> void {
+  const std::size_t threads =
+      std::max<std::size_t>(2, std::thread::hardware_concurrency());
+  constexpr std::size_t n = 20000000;
+  auto plus = [](std::size_t a, std::size_t b) { return a + b; };
+
+  auto start = std::chrono::steady_clock::now();
+  std::size_t sequential = 0;
+  for (auto v : counter_range{0, n}.generate())
+    sequential += v;
+  auto sequential_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  std::size_t parallel =
+      parallel_reduce(counter_range{0, n}, std::size_t(0), plus, threads);
+  auto parallel_time = std::chrono::steady_clock::now() - start;
+
+  std::atomic<std::size_t> odd = 0;
+  parallel_for_each(
+      counter_range{0, n},
+      [&](std::size_t v) {
+        if (v % 2)
+          odd.fetch_add(1, std::memory_order_relaxed);
+      },
+      threads);
+
+  // Przyspieszenie jest możliwe tylko przy więcej niż jednym rdzeniu - na
+  // jednym wątki robocze tylko się przeplatają, dokładając koszt przełączeń.
+  using ms = std::chrono::duration<double, std::milli>;
+  std::cout << "main: " << std::thread::hardware_concurrency()
+            << " hardware thread(s)" << std::endl;
+  std::cout << "main: sequential sum " << sequential << " in "
+            << ms(sequential_time).count() << " ms" << std::endl;
+  std::cout << "main: parallel sum " << parallel << " in "
+            << ms(parallel_time).count() << " ms on " << threads
+            << " threads" << std::endl;
+  std::cout << "main: odd numbers " << odd << std::endl;
+}
+} // namespace p19
+
+// 20. Przykład - scalanie k posortowanych generatorów drzewem przegranych.
+//
+// Drzewo przegranych (loser tree) ma k liści - bieżące wartości strumieni - i
+// k - 1 węzłów wewnętrznych, w których zapamiętany jest przegrany meczu
+// rozegranego w danym węźle. Zwycięzca całego turnieju trafia do tree_[0].
+// Po wydaniu zwycięzcy wznawiamy tylko jego generator i powtarzamy mecze na
+// ścieżce od jego liścia do korzenia: dokładnie ceil(log2 k) porównań. Kopiec
+// binarny potrzebuje ich więcej, bo porównuje zarówno przy zdejmowaniu
+// najmniejszego elementu, jak i przy wstawianiu następnego.
+namespace p20 {
+
+template <typename T, typename Compare = std::less<>> class loser_tree {
+public:
+  loser_tree(std::vector<p3::Generator<T>> gens, Compare less = {})
+      : gens_(std::move(gens)), less_(std::move(less)), heads_(gens_.size()),
+        live_(gens_.size()), tree_(std::max<std::size_t>(1, gens_.size())) {
+    for (std::size_t i = 0; i < gens_.size(); i++)
+      pull(i);
+    if (!gens_.empty())
+      tree_[0] = build(1);
+  }
+
+  bool empty() const { return gens_.empty() || !live_[tree_[0]]; }
+  T &top() { return heads_[tree_[0]]; }
+
+  // Pobiera kolejną wartość ze strumienia zwycięzcy i rozgrywa mecze na
+  // ścieżce od jego liścia do korzenia.
+  void pop() {
+    std::size_t winner = tree_[0];
+    pull(winner);
+    for (std::size_t node = (size() + winner) / 2; node > 0; node /= 2)
+      if (beats(tree_[node], winner))
+        std::swap(tree_[node], winner);
+    tree_[0] = winner;
+  }
+
+private:
+  std::size_t size() const { return gens_.size(); }
+
+  void pull(std::size_t i) {
+    live_[i] = bool(gens_[i]);
+    if (live_[i])
+      heads_[i] = gens_[i]();
+  }
+
+  // Wyczerpany strumień przegrywa z każdym. Przy równych wartościach wygrywa
+  // strumień o mniejszym indeksie, więc scalanie jest stabilne - wystarcza do
+  // tego jedno porównanie, jeżeli ustawimy argumenty według indeksów.
+  bool beats(std::size_t a, std::size_t b) {
+    if (!live_[a] || !live_[b]) [[unlikely]]
+      return live_[a] && !live_[b];
+    if (a < b)
+      return !less_(heads_[b], heads_[a]);
+    return less_(heads_[a], heads_[b]);
+  }
+
+  // Liście leżą niejawnie w węzłach size()..2 size() - 1, dzięki czemu drzewo
+  // jest pełne dla dowolnego k.
+  std::size_t build(std::size_t node) {
+    if (node >= size())
+      return node - size();
+    std::size_t left = build(2 * node), right = build(2 * node + 1);
+    if (beats(left, right)) {
+      tree_[node] = right;
+      return left;
+    }
+    tree_[node] = left;
+    return right;
+  }
+
+  std::vector<p3::Generator<T>> gens_;
+  Compare less_;
+  std::vector<T> heads_;
+  std::vector<char> live_;
+  std::vector<std::size_t> tree_;
+};
+
+// Scala posortowane generatory w jeden posortowany strumień.
+template <typename T, typename Compare = std::less<>>
+p3::Generator<T> merge(std::vector<p3::Generator<T>> gens, Compare less = {}) {
+  loser_tree<T, Compare> tree(std::move(gens), std::move(less));
+  for (; !tree.empty(); tree.pop())
+    co_yield std::move(tree.top());
+}
+
+template <typename T, std::same_as<p3::Generator<T>>... Gens>
+p3::Generator<T> merge(p3::Generator<T> first, Gens... rest) {
+  std::vector<p3::Generator<T>> gens;
+  gens.reserve(1 + sizeof...(rest));
+  gens.push_back(std::move(first));
+  (gens.push_back(std::move(rest)), ...);
+  return merge(std::move(gens));
+}
+
+// Punkt odniesienia - scalanie kopcem binarnym.
+template <typename T, typename Compare = std::less<>>
+p3::Generator<T> heap_merge(std::vector<p3::Generator<T>> gens,
+                            Compare less = {}) {
+  std::vector<std::pair<T, std::size_t>> heap;
+  auto after = [&](const auto &a, const auto &b) {
+    return less(b.first, a.first);
+  };
+  for (std::size_t i = 0; i < gens.size(); i++)
+    if (gens[i])
+      heap.emplace_back(gens[i](), i);
+  std::ranges::make_heap(heap, after);
+  while (!heap.empty()) {
+    std::ranges::pop_heap(heap, after);
+    auto &[value, i] = heap.back();
+    co_yield std::move(value);
+    if (gens[i]) {
+      value = gens[i]();
+      std::ranges::push_heap(heap, after);
+    } else {
+      heap.pop_back();
+    }
+  }
+}
+
+// Strumień stride * j + offset dla j < count.
+p3::Generator<std::uint64_t> sorted(std::uint64_t offset, std::uint64_t stride,
+                                    std::size_t count) {
+  for (std::size_t j = 0; j < count; j++)
+    co_yield offset + stride * j;
+}
+
+std::vector<p3::Generator<std::uint64_t>> streams(std::size_t k,
+                                                  std::size_t total) {
+  std::vector<p3::Generator<std::uint64_t>> gens;
+  for (std::size_t i = 0; i < k; i++)
+    gens.push_back(sorted(i, k, total / k));
+  return gens;
+}
+
+// Porównanie zliczające wywołania.
+struct counting_less {
+  std::size_t *count_;
+  bool operator()(std::uint64_t a, std::uint64_t b) const {
+    ++*count_;
+    return a < b;
+  }
+};
+
+auto main() -> void {
+  for (auto v : merge(sorted(0, 3, 4), sorted(1, 3, 3), sorted(2, 3, 2)))
+    std::cout << v << ' ';
+  std::cout << std::endl;
+
+  constexpr std::size_t total = 1 << 20;
+  for (std::size_t k : {2, 4, 16, 64, 256, 1024}) {
+    std::size_t tree_compares = 0, heap_compares = 0;
+    std::uint64_t tree_sum = 0, heap_sum = 0;
+    p14::benchmark("loser tree k=" + std::to_string(k), total,
+                   [&](std::size_t) {
+                     for (auto v : merge(streams(k, total),
+                                         counting_less{&tree_compares}))
+                       tree_sum += v;
+                   });
+    p14::benchmark("binary heap k=" + std::to_string(k), total,
+                   [&](std::size_t) {
+                     for (auto v : heap_merge(streams(k, total),
+                                              counting_less{&heap_compares}))
+                       heap_sum += v;
+                   });
+    std::cout << "main: k=" << k << " compares/op loser tree "
+              << double(tree_compares) / total << ", binary heap "
+              << double(heap_compares) / total
+              << (tree_sum == heap_sum ? "" : " (MISMATCH)") << std::endl;
+  }
+}
+} // namespace p20
+
+// 21. Przykład - sortowanie zewnętrzne danych większych niż pamięć.
+//
+// Źródło jest wczytywane do paczek po budget bajtów. Każda paczka jest
+// dzielona na threads serii, sortowanych i zapisywanych do plików
+// tymczasowych równolegle na planiście z p4. Serie są następnie scalane
+// drzewem przegranych z p20, a każdą z nich czyta generator, który prosi jądro
+// o wczytanie następnego bloku (posix_fadvise), zanim zacznie wydawać bieżący.
+// Pliki otwarte są jednocześnie co najwyżej dla max_fan_in serii na poziom:
+// gdy poziom się zapełni, jego serie są scalane w jedną serię poziomu wyżej.
+namespace p21 {
+
+struct file_closer {
+  void operator()(std::FILE *f) const { std::fclose(f); }
+};
+using file = std::unique_ptr<std::FILE, file_closer>;
+
+inline constexpr std::size_t max_fan_in = 64;
+
+[[noreturn]] void fail(const char *what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Plik tymczasowy usuwany automatycznie po zamknięciu.
+file temp_file() {
+  file f(std::tmpfile());
+  if (!f)
+    fail("external sort: tmpfile");
+  return f;
+}
+
+template <typename T> void write(std::FILE *f, const T *data, std::size_t n) {
+  if (std::fwrite(data, sizeof(T), n, f) != n)
+    fail("external sort: write");
+}
+
+// Czyta serię blokami po block elementów. pread może zwrócić mniej bajtów,
+// niż prosiliśmy (także niepełny element), więc blok dopełniamy w pętli.
+template <typename T> p3::Generator<T> read_run(file f, std::size_t block) {
+  if (std::fflush(f.get()) != 0)
+    fail("external sort: flush");
+  int fd = fileno(f.get());
+  const std::size_t bytes = block * sizeof(T);
+  std::vector<T> buffer(block);
+  auto *raw = reinterpret_cast<char *>(buffer.data());
+  for (off_t offset = 0;;) {
+    posix_fadvise(fd, offset + off_t(bytes), off_t(bytes), POSIX_FADV_WILLNEED);
+    std::size_t filled = 0;
+    while (filled < bytes) {
+      ssize_t n =
+          pread(fd, raw + filled, bytes - filled, offset + off_t(filled));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        fail("external sort: read");
+      if (n == 0)
+        break;
+      filled += std::size_t(n);
+    }
+    if (filled % sizeof(T) != 0)
+      throw std::runtime_error("external sort: truncated run");
+    offset += off_t(filled);
+    for (std::size_t i = 0; i < filled / sizeof(T); i++)
+      co_yield buffer[i];
+    if (filled < bytes)
+      break;
+  }
+}
+
+template <typename T>
+std::vector<p3::Generator<T>> readers(std::vector<file> runs,
+                                      std::size_t budget) {
+  // Połowa budżetu na bloki czytników, połowa na bufor zapisu.
+  std::size_t block =
+      std::max<std::size_t>(1, budget / 2 / sizeof(T) / runs.size());
+  std::vector<p3::Generator<T>> gens;
+  for (auto &run : runs)
+    gens.push_back(read_run<T>(std::move(run), block));
+  return gens;
+}
+
+template <typename T>
+file merge_runs(std::vector<file> runs, std::size_t budget) {
+  file out = temp_file();
+  std::vector<T> buffer;
+  buffer.reserve(std::max<std::size_t>(1, budget / 2 / sizeof(T)));
+  for (auto &&v : p20::merge(readers<T>(std::move(runs), budget))) {
+    buffer.push_back(v);
+    if (buffer.size() == buffer.capacity()) {
+      write(out.get(), buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  }
+  write(out.get(), buffer.data(), buffer.size());
+  return out;
+}
+
+template <typename T>
+void add_run(std::vector<std::vector<file>> &levels, file run,
+             std::size_t level, std::size_t budget) {
+  if (levels.size() <= level)
+    levels.resize(level + 1);
+  levels[level].push_back(std::move(run));
+  if (levels[level].size() == max_fan_in)
+    add_run<T>(levels, merge_runs<T>(std::exchange(levels[level], {}), budget),
+               level + 1, budget);
+}
+
+template <typename T> p4::task sort_run(std::vector<T> &run, file &out) {
+  std::ranges::sort(run);
+  out = temp_file();
+  write(out.get(), run.data(), run.size());
+  co_return;
+}
+
+template <typename T>
+std::vector<file> make_runs(p3::Generator<T> &source, std::size_t budget,
+                            std::size_t threads) {
+  const std::size_t run_size =
+      std::max<std::size_t>(1, budget / sizeof(T) / threads);
+  std::vector<std::vector<file>> levels;
+  std::vector<std::vector<T>> batch(threads);
+  while (source) {
+    for (auto &run : batch) {
+      run.clear();
+      run.reserve(run_size);
+      while (run.size() < run_size && source)
+        run.push_back(source());
+    }
+    std::vector<file> sorted(threads);
+    std::vector<p4::task> tasks;
+    p4::scheduler sched;
+    for (std::size_t i = 0; i < threads && !batch[i].empty(); i++)
+      tasks.push_back(sort_run(batch[i], sorted[i]));
+    for (auto &t : tasks)
+      sched.spawn(t);
+    sched.run(threads);
+    // Scalanie poziomu korzysta z całego budżetu, więc jeśli te serie je
+    // wywołają, najpierw zwalniamy bufory partii - inaczej szczyt zużycia
+    // pamięci byłby dwa razy większy. Następna partia przydzieli je od nowa.
+    if ((levels.empty() ? 0 : levels[0].size()) + tasks.size() >= max_fan_in)
+      for (auto &run : batch)
+        std::vector<T>().swap(run);
+    for (std::size_t i = 0; i < tasks.size(); i++) {
+      tasks[i].get();
+      add_run<T>(levels, std::move(sorted[i]), 0, budget);
+    }
+  }
+  std::vector<file> runs;
+  for (auto &level : levels)
+    for (auto &run : level)
+      runs.push_back(std::move(run));
+  return runs;
+}
+
+// Sortuje wartości ze źródła, używając około budget bajtów pamięci.
+template <typename T>
+  requires std::is_trivially_copyable_v<T>
+p3::Generator<T> external_sort(p3::Generator<T> source, std::size_t budget,
+                               std::size_t threads = 2) {
+  auto runs = make_runs(source, budget, threads);
+  if (runs.empty())
+    co_return;
+  for (auto &&v : p20::merge(readers<T>(std::move(runs), budget)))
+    co_yield v;
+}
+
+// Pseudolosowe wartości (xorshift64).
+p3::Generator<std::uint64_t> random_values(std::size_t count) {
+  std::uint64_t x = 88172645463325252ull;
+  for (std::size_t i = 0; i < count; i++) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    co_yield x;
+  }
+}
+
+void check(std::size_t count, std::size_t budget) {
+  std::uint64_t in_sum = 0;
+  for (auto v : random_values(count))
+    in_sum += v;
+
+  auto start = std::chrono::steady_clock::now();
+  std::size_t out_count = 0;
+  std::uint64_t out_sum = 0, previous = 0;
+  bool ordered = true;
+  for (auto v : external_sort(random_values(count), budget)) {
+    ordered = ordered && previous <= v;
+    previous = v;
+    out_sum += v;
+    out_count++;
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::cout << "main: sorted " << count * sizeof(std::uint64_t) / 1024
+            << " KiB with a " << budget / 1024 << " KiB budget in "
+            << elapsed.count() << " ms: "
+            << (ordered && out_count == count && out_sum == in_sum ? "ok"
+                                                                   : "FAILED")
+            << std::endl;
+}
+
+auto main() -> void {
+  // Kilkanaście serii scalanych w jednym przebiegu.
+  check(4 << 20, 2 << 20);
+  // Tysiące serii - scalanie wielopoziomowe.
+  check(1 << 20, 8 << 10);
+}
+} // namespace p21
+
+// 22. Przykład - agregacja po kluczu (group by) z zapisem nadmiaru na dysk.
+//
+// Stany agregatów trzymane są w tablicy z adresowaniem otwartym i liniowym
+// próbkowaniem - klucz, stan i znacznik zajętości leżą obok siebie, więc
+// trafienie kosztuje zwykle jeden odczyt linii pamięci podręcznej. Jeżeli
+// powiększenie tablicy przekroczyłoby budżet, jej zawartość (częściowe
+// agregaty) jest dopisywana do partition_count plików według bitów skrótu
+// klucza, a tablica jest czyszczona.
+// Na końcu każda partycja jest agregowana osobno, w razie potrzeby dzieląc się
+// dalej według kolejnych bitów skrótu.
+//
+// Agregator opisuje typ stanu (state_type, inicjalizowany wartością), dodanie
+// wartości do stanu (add) oraz połączenie dwóch stanów częściowych (merge).
+namespace p22 {
+
+template <typename A, typename T>
+concept aggregator = requires(A a, typename A::state_type &s, const T &v) {
+  a.add(s, v);
+  a.merge(s, std::as_const(s));
+};
+
+inline constexpr std::size_t partition_bits = 4;
+inline constexpr std::size_t partition_count = 1 << partition_bits;
+inline constexpr std::size_t max_depth = 64 / partition_bits - 1;
+
+// Finalizator MurmurHash3 - std::hash dla liczb jest zwykle identycznością.
+inline std::uint64_t mix(std::uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+template <typename K, typename Agg> class aggregation {
+public:
+  using state_type = typename Agg::state_type;
+  struct entry {
+    K key_;
+    state_type state_;
+  };
+  static_assert(std::is_trivially_copyable_v<entry>,
+                "spilled keys and states are written as raw bytes");
+  // Znacznik zajętości w tej samej linii co wpis; na dysk trafia sam wpis.
+  struct slot {
+    entry entry_;
+    bool used_;
+  };
+
+  aggregation(Agg agg, std::size_t budget, std::size_t depth = 0)
+      : agg_(std::move(agg)), budget_(budget), depth_(depth) {
+    resize(min_capacity);
+  }
+
+  template <typename T> void add(const K &key, const T &value) {
+    agg_.add(find(key), value);
+  }
+  void merge(const K &key, const state_type &state) {
+    agg_.merge(find(key), state);
+  }
+
+  std::size_t spills() const { return spills_; }
+
+  // Wydaje wszystkie grupy; po zakończeniu tablica jest pusta.
+  p3::Generator<std::pair<K, state_type>> results() {
+    if (spills_ == 0) {
+      for (auto &s : slots_)
+        if (s.used_)
+          co_yield std::pair{s.entry_.key_, s.entry_.state_};
+      resize(min_capacity);
+      co_return;
+    }
+    spill();
+    resize(min_capacity);
+    auto partitions = std::exchange(partitions_, {});
+    std::size_t block = std::max<std::size_t>(1, budget_ / 2 / sizeof(entry));
+    for (auto &partition : partitions) {
+      if (!partition)
+        continue;
+      aggregation child(agg_, budget_ / 2, depth_ + 1);
+      for (auto &e : p21::read_run<entry>(std::move(partition), block))
+        child.merge(e.key_, e.state_);
+      for (auto &&group : child.results())
+        co_yield group;
+    }
+  }
+
+private:
+  static constexpr std::size_t min_capacity = 16;
+
+  static std::uint64_t hash(const K &key) { return mix(std::hash<K>{}(key)); }
+  static std::size_t bytes(std::size_t capacity) {
+    return capacity * sizeof(slot);
+  }
+
+  state_type &find(const K &key) {
+    std::uint64_t h = hash(key);
+    for (std::size_t i = h & mask_;; i = (i + 1) & mask_) {
+      slot &s = slots_[i];
+      if (!s.used_) {
+        if (grow()) // Po zmianie tablicy szukamy miejsca od nowa.
+          return find(key);
+        size_++;
+        s = slot{entry{key, state_type{}}, true};
+        return s.entry_.state_;
+      }
+      if (s.entry_.key_ == key)
+        return s.entry_.state_;
+    }
+  }
+
+  // Powiększa tablicę przy zapełnieniu w 3/4, a jeżeli nie pozwala na to
+  // budżet - zapisuje jej zawartość na dysk i opróżnia ją.
+  bool grow() {
+    if (4 * (size_ + 1) <= 3 * slots_.size())
+      return false;
+    if (bytes(2 * slots_.size()) <= budget_ || depth_ == max_depth) {
+      auto slots = std::exchange(slots_, {});
+      resize(2 * slots.size());
+      for (auto &s : slots)
+        if (s.used_)
+          insert_new(s.entry_);
+    } else {
+      spill();
+      for (auto &s : slots_)
+        s.used_ = false;
+      size_ = 0;
+    }
+    return true;
+  }
+
+  void insert_new(const entry &e) {
+    std::size_t i = hash(e.key_) & mask_;
+    while (slots_[i].used_)
+      i = (i + 1) & mask_;
+    slots_[i] = slot{e, true};
+    size_++;
+  }
+
+  // Nowy wektor zamiast assign - zmniejszenie tablicy oddaje też pamięć.
+  void resize(std::size_t capacity) {
+    slots_ = std::vector<slot>(capacity, slot{});
+    mask_ = capacity - 1;
+    size_ = 0;
+  }
+
+  // Partycja zależy od kolejnych partition_bits najstarszych bitów skrótu na
+  // każdym poziomie, a pozycja w tablicy od najmłodszych.
+  void spill() {
+    if (partitions_.empty())
+      partitions_.resize(partition_count);
+    const std::size_t shift = 64 - partition_bits * (depth_ + 1);
+    for (auto &s : slots_) {
+      if (!s.used_)
+        continue;
+      auto &partition = partitions_[(hash(s.entry_.key_) >> shift) &
+                                    (partition_count - 1)];
+      if (!partition)
+        partition = p21::temp_file();
+      p21::write(partition.get(), &s.entry_, 1);
+    }
+    spills_++;
+  }
+
+  Agg agg_;
+  std::size_t budget_;
+  std::size_t depth_;
+  std::vector<slot> slots_;
+  std::size_t mask_ = 0;
+  std::size_t size_ = 0;
+  std::size_t spills_ = 0;
+  std::vector<p21::file> partitions_;
+};
+
+template <typename T, typename KeyFn>
+using group_key_t =
+    std::remove_cvref_t<std::invoke_result_t<KeyFn &, const T &>>;
+
+template <typename T, typename KeyFn, aggregator<T> Agg>
+using group_t = std::pair<group_key_t<T, KeyFn>, typename Agg::state_type>;
+
+// Agreguje wartości generatora po kluczu key(v), używając około budget bajtów
+// pamięci. Grupy są wydawane po wyczerpaniu wejścia, w dowolnej kolejności.
+template <typename T, typename KeyFn, aggregator<T> Agg>
+p3::Generator<group_t<T, KeyFn, Agg>>
+group_by(p3::Generator<T> gen, KeyFn key, Agg agg, std::size_t budget) {
+  aggregation<group_key_t<T, KeyFn>, Agg> table(std::move(agg), budget);
+  for (auto &&v : gen)
+    table.add(key(v), v);
+  for (auto &&group : table.results())
+    co_yield group;
+}
+
+template <typename S>
+using piece_value_t =
+    std::ranges::range_value_t<decltype(std::declval<S>().generate())>;
+
+template <typename S, typename KeyFn, typename Agg>
+using range_group_t = group_t<piece_value_t<S>, KeyFn, Agg>;
+
+template <typename K, typename Agg, typename S, typename KeyFn>
+p4::task partial_group_by(S piece, KeyFn &key, aggregation<K, Agg> &table) {
+  for (auto &&v : piece.generate())
+    table.add(key(v), v);
+  co_return;
+}
+
+// Tryb równoległy: zakres jest dzielony na części agregowane do własnych
+// tablic na wątkach planisty z p4. Części bywa więcej niż wątków, więc idą
+// falami po threads - tablice fali są łączone z wynikową i zwalniane, zanim
+// ruszy następna. Połowa budżetu przypada na tablicę wynikową, połowa na
+// threads tablic częściowych.
+template <p19::splittable S, typename KeyFn, aggregator<piece_value_t<S>> Agg>
+p3::Generator<range_group_t<S, KeyFn, Agg>>
+parallel_group_by(S s, KeyFn key, Agg agg, std::size_t budget,
+                  std::size_t threads) {
+  using K = typename range_group_t<S, KeyFn, Agg>::first_type;
+  std::vector<S> pieces;
+  std::size_t grain =
+      std::max<std::size_t>(1, (s.size() + threads - 1) / threads);
+  p19::split(std::move(s), grain, pieces);
+
+  aggregation<K, Agg> table(agg, budget / 2);
+  p4::scheduler sched;
+  sched.start(threads);
+  for (std::size_t first = 0; first < pieces.size(); first += threads) {
+    std::size_t count = std::min(threads, pieces.size() - first);
+    std::vector<aggregation<K, Agg>> partial;
+    partial.reserve(count);
+    for (std::size_t i = 0; i < count; i++)
+      partial.emplace_back(agg, budget / 2 / threads);
+    std::vector<p4::task> tasks;
+    for (std::size_t i = 0; i < count; i++)
+      tasks.push_back(
+          partial_group_by(std::move(pieces[first + i]), key, partial[i]));
+    for (auto &t : tasks)
+      sched.spawn(t);
+    sched.run();
+    for (auto &t : tasks)
+      t.get();
+    // results() opróżnia tablicę częściową, zwalniając jej pamięć.
+    for (auto &part : partial)
+      for (auto &&[k, state] : part.results())
+        table.merge(k, state);
+  }
+  // Wątki nie są już potrzebne, gdy konsument odbiera grupy.
+  sched.stop();
+  for (auto &&group : table.results())
+    co_yield group;
+}
+
+// Liczba i suma wartości w grupie.
+struct count_sum {
+  struct state_type {
+    std::uint64_t count_;
+    std::uint64_t sum_;
+  };
+  void add(state_type &s, std::uint64_t v) const {
+    s.count_++;
+    s.sum_ += v;
+  }
+  void merge(state_type &s, const state_type &other) const {
+    s.count_ += other.count_;
+    s.sum_ += other.sum_;
+  }
+};
+
+void report(const std::string &name, auto &&groups, std::size_t count,
+            std::uint64_t sum, std::chrono::steady_clock::time_point start) {
+  std::size_t n = 0, total_count = 0;
+  std::uint64_t total_sum = 0;
+  for (auto &&[key, state] : groups) {
+    n++;
+    total_count += state.count_;
+    total_sum += state.sum_;
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "main: " << name << ": " << n << " groups in "
+            << elapsed.count() << " ms: "
+            << (total_count == count && total_sum == sum ? "ok" : "FAILED")
+            << std::endl;
+}
+
+auto main() -> void {
+  constexpr std::size_t n = 1 << 21;
+  std::uint64_t sum = 0;
+  for (auto v : p21::random_values(n))
+    sum += v;
+
+  for (std::uint64_t keys : {1000, 200000}) {
+    auto key = [keys](std::uint64_t v) { return v % keys; };
+    for (std::size_t budget : {16 << 20, 256 << 10}) {
+      auto start = std::chrono::steady_clock::now();
+      report(std::to_string(budget >> 10) + " KiB budget",
+             group_by(p21::random_values(n), key, count_sum{}, budget), n, sum,
+             start);
+    }
+  }
+
+  auto key = [](std::uint64_t v) { return mix(v) % 100000; };
+  constexpr std::uint64_t range_sum = std::uint64_t(n) * (n - 1) / 2;
+  const std::size_t threads =
+      std::max<std::size_t>(2, std::thread::hardware_concurrency());
+  auto start = std::chrono::steady_clock::now();
+  report("sequential",
+         group_by(p19::counter(0, n), key, count_sum{}, 16 << 20), n,
+         range_sum, start);
+  start = std::chrono::steady_clock::now();
+  report("parallel on " + std::to_string(threads) + " threads",
+         parallel_group_by(p19::counter_range{0, n}, key, count_sum{},
+                           16 << 20, threads),
+         n, range_sum, start);
+}
+} // namespace p22
+
+// 23. Przykład - kolumnowy format binarny dla strumieni rekordów.
+//
+// Wypisywanie wyników generatorów tekstowo (jak w poprzednich przykładach)
+// jest powolne i zajmuje dużo miejsca. write_columns zapisuje wybrane pola
+// rekordów generatora kolumnami, w blokach po block_rows wierszy. Każda kolumna
+// każdego bloku jest kodowana tym z kodowań, które daje najmniejszy wynik:
+//   - plain - surowe wartości,
+//   - frame_of_reference - minimum i upakowane bitowo różnice od niego,
+//   - delta - pierwsza wartość i upakowane bitowo różnice kolejnych wartości
+//     (w kodowaniu zigzag, aby małe ujemne różnice miały mało bitów),
+//   - dictionary - posortowany słownik i upakowane bitowo indeksy do niego.
+// Plik jest ciągiem 64-bitowych słów, więc czytnik read_columns może go
+// zmapować (mmap) i dekodować bezpośrednio z pamięci, wydając paczki kolumn.
+// Czytnik dekoduje tylko wybrane kolumny, pozostałe przeskakuje.
+//
+// Układ pliku:
+//   magic | liczba kolumn << 32
+//   dla każdego bloku: liczba wierszy, a dla każdej kolumny: liczba słów i
+//   słowa kolumny - nagłówek (kodowanie | szerokość << 8 | rozmiar słownika
+//   << 16), wartość bazowa, słownik i upakowane wartości.
+namespace p23 {
+
+enum class encoding : std::uint8_t {
+  plain,
+  frame_of_reference,
+  delta,
+  dictionary,
+};
+
+inline constexpr std::uint64_t magic = 0x43333270; // "p23C"
+inline constexpr std::size_t block_rows = 4096;
+
+inline std::uint64_t zigzag(std::uint64_t delta) {
+  return (delta << 1) ^ (0 - (delta >> 63));
+}
+inline std::uint64_t unzigzag(std::uint64_t v) {
+  return (v >> 1) ^ (0 - (v & 1));
+}
+
+inline std::size_t packed_words(std::size_t count, unsigned width) {
+  return (count * width + 63) / 64;
+}
+
+// Dopisuje wartości do out, po width bitów na wartość.
+template <typename Values>
+void pack(std::vector<std::uint64_t> &out, const Values &values,
+          unsigned width) {
+  std::size_t base = out.size();
+  out.resize(base + packed_words(std::ranges::size(values), width), 0);
+  if (width == 0)
+    return;
+  std::size_t bit = 0;
+  for (std::uint64_t v : values) {
+    std::size_t word = base + bit / 64;
+    unsigned offset = bit % 64;
+    out[word] |= v << offset;
+    if (offset + width > 64)
+      out[word + 1] |= v >> (64 - offset);
+    bit += width;
+  }
+}
+
+inline std::uint64_t unpack(const std::uint64_t *words, std::size_t i,
+                            unsigned width) {
+  if (width == 0)
+    return 0;
+  std::size_t bit = i * width;
+  unsigned offset = bit % 64;
+  std::uint64_t v = words[bit / 64] >> offset;
+  if (offset + width > 64)
+    v |= words[bit / 64 + 1] << (64 - offset);
+  return width == 64 ? v : v & ((std::uint64_t(1) << width) - 1);
+}
+
+[[noreturn]] inline void corrupt() {
+  throw std::runtime_error("columnar: corrupt file");
+}
+
+inline std::uint64_t header(encoding e, unsigned width,
+                            std::size_t dictionary = 0) {
+  return std::uint64_t(e) | std::uint64_t(width) << 8 |
+         std::uint64_t(dictionary) << 16;
+}
+
+// Koduje niepustą kolumnę bloku najkrótszym z kodowań.
+inline std::vector<std::uint64_t>
+encode(const std::vector<std::uint64_t> &values) {
+  const std::size_t n = values.size();
+  auto [lo, hi] = std::ranges::minmax(values);
+  unsigned for_width = std::bit_width(hi - lo);
+
+  std::uint64_t max_delta = 0;
+  for (std::size_t i = 1; i < n; i++)
+    max_delta = std::max(max_delta, zigzag(values[i] - values[i - 1]));
+  unsigned delta_width = std::bit_width(max_delta);
+
+  std::vector<std::uint64_t> dictionary = values;
+  std::ranges::sort(dictionary);
+  dictionary.erase(std::ranges::unique(dictionary).begin(), dictionary.end());
+  unsigned dictionary_width = std::bit_width(dictionary.size() - 1);
+
+  const std::array<std::size_t, 4> sizes = {
+      n,
+      2 + packed_words(n, for_width),
+      2 + packed_words(n - 1, delta_width),
+      2 + dictionary.size() + packed_words(n, dictionary_width),
+  };
+  auto best = encoding(std::ranges::min_element(sizes) - sizes.begin());
+
+  std::vector<std::uint64_t> out;
+  out.reserve(sizes[std::size_t(best)]);
+  switch (best) {
+  case encoding::plain:
+    out = values;
+    break;
+  case encoding::frame_of_reference:
+    out = {header(best, for_width), lo};
+    pack(out,
+         values | std::views::transform([lo](auto v) { return v - lo; }),
+         for_width);
+    break;
+  case encoding::delta:
+    out = {header(best, delta_width), values[0]};
+    pack(out,
+         std::views::iota(std::size_t(1), n) |
+             std::views::transform([&](std::size_t i) {
+               return zigzag(values[i] - values[i - 1]);
+             }),
+         delta_width);
+    break;
+  case encoding::dictionary:
+    out = {header(best, dictionary_width, dictionary.size()), 0};
+    out.insert(out.end(), dictionary.begin(), dictionary.end());
+    pack(out, values | std::views::transform([&](auto v) {
+                return std::uint64_t(
+                    std::ranges::lower_bound(dictionary, v) -
+                    dictionary.begin());
+              }),
+         dictionary_width);
+    break;
+  }
+  return out;
+}
+
+// Dekoduje kolumnę bloku o rows > 0 wierszach zapisaną w size słowach.
+// Rozmiar musi dokładnie odpowiadać nagłówkowi, a indeksy - słownikowi.
+inline void decode(const std::uint64_t *words, std::size_t size,
+                   std::size_t rows, std::vector<std::uint64_t> &out) {
+  out.resize(rows);
+  // Kodowanie plain nie ma nagłówka. Rozpoznajemy je po rozmiarze, bo
+  // pozostałe kodowania są wybierane tylko, gdy są krótsze.
+  if (size == rows) {
+    std::copy_n(words, rows, out.begin());
+    return;
+  }
+  if (size < 2)
+    corrupt();
+  auto e = encoding(words[0] & 0xff);
+  unsigned width = (words[0] >> 8) & 0xff;
+  std::uint64_t base = words[1];
+  const std::uint64_t *packed = words + 2;
+  if (width > 64)
+    corrupt();
+  switch (e) {
+  case encoding::frame_of_reference:
+    if (size - 2 != packed_words(rows, width))
+      corrupt();
+    for (std::size_t i = 0; i < rows; i++)
+      out[i] = base + unpack(packed, i, width);
+    break;
+  case encoding::delta:
+    if (size - 2 != packed_words(rows - 1, width))
+      corrupt();
+    out[0] = base;
+    for (std::size_t i = 1; i < rows; i++)
+      out[i] = out[i - 1] + unzigzag(unpack(packed, i - 1, width));
+    break;
+  case encoding::dictionary: {
+    std::size_t entries = words[0] >> 16;
+    if (entries == 0 || entries > size - 2 ||
+        size - 2 - entries != packed_words(rows, width))
+      corrupt();
+    const std::uint64_t *dictionary = packed;
+    packed += entries;
+    for (std::size_t i = 0; i < rows; i++) {
+      auto index = unpack(packed, i, width);
+      if (index >= entries)
+        corrupt();
+      out[i] = dictionary[index];
+    }
+    break;
+  }
+  default:
+    throw std::runtime_error("columnar: unknown encoding");
+  }
+}
+
+// Zapisuje wskazane pola rekordów do pliku path. Wartości ze znakiem są
+// zapisywane jako ich reprezentacja bez znaku. Zwraca rozmiar pliku w bajtach.
+template <typename Record, std::integral... Fields>
+  requires(sizeof...(Fields) > 0)
+std::size_t write_columns(const std::string &path, p3::Generator<Record> gen,
+                          Fields Record::*...fields) {
+  p21::file out(std::fopen(path.c_str(), "wb"));
+  if (!out)
+    p21::fail("columnar: open");
+  std::uint64_t head = magic | std::uint64_t(sizeof...(Fields)) << 32;
+  p21::write(out.get(), &head, 1);
+  std::size_t words = 1;
+
+  std::array<std::vector<std::uint64_t>, sizeof...(Fields)> block;
+  auto flush = [&] {
+    std::uint64_t rows = block[0].size();
+    p21::write(out.get(), &rows, 1);
+    words++;
+    for (auto &column : block) {
+      auto encoded = encode(column);
+      std::uint64_t size = encoded.size();
+      p21::write(out.get(), &size, 1);
+      p21::write(out.get(), encoded.data(), encoded.size());
+      words += 1 + size;
+      column.clear();
+    }
+  };
+  for (auto &&record : gen) {
+    std::size_t c = 0;
+    (block[c++].push_back(static_cast<std::uint64_t>(record.*fields)), ...);
+    if (block[0].size() == block_rows)
+      flush();
+  }
+  if (!block[0].empty())
+    flush();
+  if (std::fflush(out.get()) != 0)
+    p21::fail("columnar: write");
+  return words * sizeof(std::uint64_t);
+}
+
+// Plik zmapowany tylko do odczytu.
+class mapping {
+public:
+  explicit mapping(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      p21::fail("columnar: open");
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (data_ = mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE,
+                      fd, 0)) == MAP_FAILED) {
+      int error = errno;
+      close(fd);
+      throw std::system_error(error, std::generic_category(), "columnar: mmap");
+    }
+    close(fd);
+    size_ = std::size_t(st.st_size);
+    madvise(data_, size_, MADV_SEQUENTIAL);
+  }
+  mapping(const mapping &) = delete;
+  mapping &operator=(const mapping &) = delete;
+  ~mapping() { munmap(data_, size_); }
+
+  const std::uint64_t *begin() const {
+    return static_cast<const std::uint64_t *>(data_);
+  }
+  const std::uint64_t *end() const {
+    return begin() + size_ / sizeof(std::uint64_t);
+  }
+
+private:
+  void *data_;
+  std::size_t size_;
+};
+
+struct column_batch {
+  std::size_t rows_ = 0;
+  // Kolumny w kolejności podanej czytnikowi.
+  std::vector<std::vector<std::uint64_t>> columns_;
+};
+
+// Wydaje kolejne bloki pliku - tylko kolumny o podanych numerach albo
+// wszystkie, jeżeli projection jest puste.
+p3::Generator<column_batch>
+read_columns(std::string path, std::vector<std::size_t> projection = {}) {
+  mapping file(path);
+  const std::uint64_t *p = file.begin(), *end = file.end();
+  if (p == end || (*p & 0xffffffff) != magic)
+    corrupt();
+  const std::size_t columns = *p++ >> 32;
+  if (projection.empty())
+    for (std::size_t c = 0; c < columns; c++)
+      projection.push_back(c);
+  if (std::ranges::any_of(projection, [&](auto c) { return c >= columns; }))
+    throw std::out_of_range("columnar: no such column");
+
+  std::vector<std::pair<const std::uint64_t *, std::size_t>> starts(columns);
+  while (p != end) {
+    column_batch batch{*p++, {}};
+    if (batch.rows_ == 0 || batch.rows_ > block_rows)
+      corrupt();
+    for (auto &[start, size] : starts) {
+      if (p == end || std::size_t(end - p) - 1 < *p)
+        corrupt();
+      size = *p++;
+      start = p;
+      p += size;
+    }
+    batch.columns_.resize(projection.size());
+    for (std::size_t j = 0; j < projection.size(); j++) {
+      auto [start, size] = starts[projection[j]];
+      decode(start, size, batch.rows_, batch.columns_[j]);
+    }
+    co_yield std::move(batch);
+  }
+}
+
+struct trade {
+  std::uint64_t time_;
+  std::uint32_t price_;
+  std::uint16_t symbol_;
+};
+
+p3::Generator<trade> trades(std::size_t count) {
+  std::uint64_t time = 1700000000000000000ull;
+  std::uint32_t price = 100000;
+  for (auto x : p21::random_values(count)) {
+    time += 1 + x % 1000;
+    price = price + (x >> 20) % 21 - 10;
+    auto symbol = std::uint16_t((x >> 40) % 50 * 1307);
+    co_yield trade{time, price, symbol};
+  }
+}
+
+auto main() -> void {
+  using ms = std::chrono::duration<double, std::milli>;
+  constexpr std::size_t n = 1 << 20;
+  std::uint64_t price_sum = 0;
+  for (auto t : trades(n))
+    price_sum += t.price_;
+
+  auto start = std::chrono::steady_clock::now();
+  std::ostringstream text;
+  for (auto t : trades(n))
+    text << t.time_ << ' ' << t.price_ << ' ' << t.symbol_ << '\n';
+  std::cout << "main: text: " << double(text.str().size()) / n
+            << " bytes/row, written in "
+            << ms(std::chrono::steady_clock::now() - start).count() << " ms"
+            << std::endl;
+
+  char path[] = "/tmp/p23-XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+    p21::fail("columnar: mkstemp");
+  close(fd);
+
+  start = std::chrono::steady_clock::now();
+  std::size_t bytes = write_columns(path, trades(n), &trade::time_,
+                                    &trade::price_, &trade::symbol_);
+  std::cout << "main: columnar: " << double(bytes) / n
+            << " bytes/row, written in "
+            << ms(std::chrono::steady_clock::now() - start).count() << " ms"
+            << std::endl;
+
+  for (auto projection : {std::vector<std::size_t>{0, 1, 2}, {1}}) {
+    start = std::chrono::steady_clock::now();
+    std::size_t rows = 0;
+    std::uint64_t sum = 0;
+    auto price = std::ranges::find(projection, 1) - projection.begin();
+    for (auto &&batch : read_columns(path, projection)) {
+      rows += batch.rows_;
+      for (auto v : batch.columns_[price])
+        sum += v;
+    }
+    std::cout << "main: scan of " << projection.size() << " column(s) in "
+              << ms(std::chrono::steady_clock::now() - start).count() << " ms: "
+              << (rows == n && sum == price_sum ? "ok" : "FAILED") << std::endl;
+  }
+
+  // Uszkodzone pliki: kolumna krótsza niż nagłówek i indeks spoza słownika.
+  const std::uint64_t head = magic | std::uint64_t(1) << 32;
+  const std::vector<std::vector<std::uint64_t>> damaged = {
+      {head, 2, 1, header(encoding::frame_of_reference, 8)},
+      {head, 2, 4, header(encoding::dictionary, 1, 1), 0, 5, 0b10},
+  };
+  for (auto &words : damaged) {
+    {
+      p21::file out(std::fopen(path, "wb"));
+      if (!out)
+        p21::fail("columnar: open");
+      p21::write(out.get(), words.data(), words.size());
+    }
+    try {
+      for (auto &&batch : read_columns(path))
+        (void)batch;
+      std::cout << "main: corrupt file accepted: FAILED" << std::endl;
+    } catch (const std::runtime_error &e) {
+      std::cout << "main: " << e.what() << std::endl;
+    }
+  }
+  unlink(path);
+}
+} // namespace p23
+
+// 24. Przykład - dekodowanie skompresowanych ciągów liczb instrukcjami SIMD.
+//
+// Rosnące ciągi liczb (takie jak z p3::counter) dobrze się kompresują, jeżeli
+// zapisujemy różnice kolejnych wartości (delta) możliwie małą liczbą bajtów:
+//   - varint - 7 bitów wartości na bajt, najstarszy bit oznacza kontynuację;
+//     dekodowanie wymaga sprawdzania każdego bajtu po kolei,
+//   - stream-vbyte - każda wartość zajmuje 1 do 4 bajtów, a długości czterech
+//     kolejnych wartości opisuje osobny bajt sterujący (po 2 bity). Bajt
+//     sterujący wybiera z tablicy maskę dla instrukcji pshufb (SSSE3), która
+//     jednym ruchem rozkłada 4 wartości na 32-bitowe pola rejestru; wersja
+//     AVX2 dekoduje tak 8 wartości naraz.
+// Różnice są następnie sumowane prefiksowo w rejestrach SIMD. Wersja
+// dekodera jest wybierana w czasie działania (__builtin_cpu_supports).
+//
+// Strumień składa się z niezależnych bloków po block_size wartości. Nagłówek
+// bloku to liczba wartości i długość danych w bajtach (po 4 bajty,
+// little-endian), a pierwsza różnica w bloku liczona jest od zera.
+namespace p24 {
+
+enum class codec { varint, stream_vbyte };
+
+inline constexpr std::size_t block_size = 1024;
+
+inline void put32(std::vector<std::uint8_t> &out, std::uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    out.push_back(std::uint8_t(v >> (8 * i)));
+}
+inline std::uint32_t get32(const std::uint8_t *p) {
+  return std::uint32_t(p[0]) | std::uint32_t(p[1]) << 8 |
+         std::uint32_t(p[2]) << 16 | std::uint32_t(p[3]) << 24;
+}
+
+inline void encode_block(std::vector<std::uint8_t> &out,
+                         const std::vector<std::uint32_t> &values, codec c) {
+  put32(out, std::uint32_t(values.size()));
+  std::size_t size_at = out.size();
+  put32(out, 0);
+  std::size_t payload = out.size();
+
+  std::uint32_t previous = 0;
+  if (c == codec::varint) {
+    for (std::uint32_t v : values) {
+      std::uint32_t delta = v - std::exchange(previous, v);
+      for (; delta >= 0x80; delta >>= 7)
+        out.push_back(std::uint8_t(delta | 0x80));
+      out.push_back(std::uint8_t(delta));
+    }
+  } else {
+    std::size_t control = out.size();
+    out.resize(out.size() + (values.size() + 3) / 4, 0);
+    for (std::size_t i = 0; i < values.size(); i++) {
+      std::uint32_t delta = values[i] - std::exchange(previous, values[i]);
+      unsigned bytes = std::max(1u, unsigned(std::bit_width(delta) + 7) / 8);
+      out[control + i / 4] |= std::uint8_t((bytes - 1) << (2 * (i % 4)));
+      for (unsigned b = 0; b < bytes; b++)
+        out.push_back(std::uint8_t(delta >> (8 * b)));
+    }
+  }
+
+  std::uint32_t size = std::uint32_t(out.size() - payload);
+  for (int i = 0; i < 4; i++)
+    out[size_at + i] = std::uint8_t(size >> (8 * i));
+}
+
+// Odbiornik - koduje cały generator.
+inline std::vector<std::uint8_t> encode(p3::Generator<std::uint32_t> gen,
+                                        codec c) {
+  std::vector<std::uint8_t> out;
+  std::vector<std::uint32_t> block;
+  block.reserve(block_size);
+  for (auto v : gen) {
+    block.push_back(v);
+    if (block.size() == block_size) {
+      encode_block(out, block, c);
+      block.clear();
+    }
+  }
+  if (!block.empty())
+    encode_block(out, block, c);
+  return out;
+}
+
+[[noreturn]] inline void corrupt() {
+  throw std::runtime_error("integer stream: corrupt block");
+}
+
+// Wartość 32-bitowa zajmuje co najwyżej 5 bajtów, a piąty bajt niesie tylko
+// 4 najstarsze bity - dłuższe zapisy są uszkodzone.
+inline void decode_varint(const std::uint8_t *data, const std::uint8_t *end,
+                          std::size_t n, std::uint32_t *out) {
+  std::uint32_t previous = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    std::uint32_t delta = 0;
+    for (int shift = 0;; shift += 7) {
+      if (data == end || (shift == 28 && *data > 0x0f))
+        corrupt();
+      std::uint8_t byte = *data++;
+      delta |= std::uint32_t(byte & 0x7f) << shift;
+      if (byte < 0x80)
+        break;
+    }
+    out[i] = previous += delta;
+  }
+  if (data != end)
+    corrupt();
+}
+
+// Maska pshufb i łączna długość czterech wartości dla każdego bajtu
+// sterującego. Bajty 0xff w masce zerują starsze bajty wartości.
+struct svb_tables {
+  std::array<std::array<std::uint8_t, 16>, 256> shuffle_;
+  std::array<std::uint8_t, 256> length_;
+};
+
+constexpr svb_tables make_svb_tables() {
+  svb_tables t{};
+  for (unsigned c = 0; c < 256; c++) {
+    unsigned pos = 0;
+    for (unsigned k = 0; k < 4; k++) {
+      unsigned len = ((c >> (2 * k)) & 3) + 1;
+      for (unsigned b = 0; b < 4; b++)
+        t.shuffle_[c][4 * k + b] = b < len ? std::uint8_t(pos + b) : 0xff;
+      pos += len;
+    }
+    t.length_[c] = std::uint8_t(pos);
+  }
+  return t;
+}
+
+inline constexpr svb_tables svb = make_svb_tables();
+
+// Łączna długość danych n wartości opisanych bajtami sterującymi control.
+inline std::size_t svb_data_length(const std::uint8_t *control, std::size_t n) {
+  std::size_t length = 0;
+  for (std::size_t j = 0; j < n / 4; j++)
+    length += svb.length_[control[j]];
+  for (std::size_t i = n / 4 * 4; i < n; i++)
+    length += ((control[i / 4] >> (2 * (i % 4))) & 3) + 1;
+  return length;
+}
+
+// Dekoduje wartości od i-tej do końca bloku; pierwsze i wartości są już w out.
+inline void svb_decode_tail(const std::uint8_t *control,
+                            const std::uint8_t *data, std::size_t i,
+                            std::size_t n, std::uint32_t *out) {
+  std::uint32_t previous = i > 0 ? out[i - 1] : 0;
+  for (; i < n; i++) {
+    unsigned len = ((control[i / 4] >> (2 * (i % 4))) & 3) + 1;
+    std::uint32_t delta = 0;
+    for (unsigned b = 0; b < len; b++)
+      delta |= std::uint32_t(*data++) << (8 * b);
+    out[i] = previous += delta;
+  }
+}
+
+// Dekoder bloku stream-vbyte: bajty sterujące, dane, koniec danych, liczba
+// wartości i miejsce na nie.
+using svb_decoder = void (*)(const std::uint8_t *, const std::uint8_t *,
+                             const std::uint8_t *, std::size_t,
+                             std::uint32_t *);
+
+inline void svb_decode_scalar(const std::uint8_t *control,
+                              const std::uint8_t *data, const std::uint8_t *,
+                              std::size_t n, std::uint32_t *out) {
+  svb_decode_tail(control, data, 0, n, out);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Wektorowe odczyty pobierają zawsze 16 bajtów, więc pętle kończą się, zanim
+// dane się skończą, a resztę dekoduje svb_decode_tail.
+
+[[gnu::target("ssse3")]] inline void
+svb_decode_ssse3(const std::uint8_t *control, const std::uint8_t *data,
+                 const std::uint8_t *end, std::size_t n, std::uint32_t *out) {
+  __m128i previous = _mm_setzero_si128();
+  std::size_t i = 0;
+  for (; i + 4 <= n && end - data >= 16; i += 4) {
+    std::uint8_t c = control[i / 4];
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+    v = _mm_shuffle_epi8(v, _mm_loadu_si128(reinterpret_cast<const __m128i *>(
+                                svb.shuffle_[c].data())));
+    data += svb.length_[c];
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi32(v, previous);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), v);
+    previous = _mm_shuffle_epi32(v, 0xff);
+  }
+  svb_decode_tail(control, data, i, n, out);
+}
+
+[[gnu::target("avx2")]] inline void
+svb_decode_avx2(const std::uint8_t *control, const std::uint8_t *data,
+                const std::uint8_t *end, std::size_t n, std::uint32_t *out) {
+  auto load = [](const std::uint8_t *p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  };
+  __m128i previous = _mm_setzero_si128();
+  std::size_t i = 0;
+  for (; i + 8 <= n && end - data >= 32; i += 8) {
+    std::uint8_t c0 = control[i / 4], c1 = control[i / 4 + 1];
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(load(data)),
+                                        load(data + svb.length_[c0]), 1);
+    __m256i mask = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(load(svb.shuffle_[c0].data())),
+        load(svb.shuffle_[c1].data()), 1);
+    v = _mm256_shuffle_epi8(v, mask);
+    data += svb.length_[c0] + svb.length_[c1];
+    // Sumy prefiksowe w obu 128-bitowych połówkach, potem przeniesienie
+    // z poprzednich wartości.
+    v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+    v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+    __m128i lo = _mm_add_epi32(_mm256_castsi256_si128(v), previous);
+    __m128i hi = _mm_add_epi32(_mm256_extracti128_si256(v, 1),
+                               _mm_shuffle_epi32(lo, 0xff));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), lo);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 4), hi);
+    previous = _mm_shuffle_epi32(hi, 0xff);
+  }
+  svb_decode_tail(control, data, i, n, out);
+}
+#endif
+
+inline svb_decoder best_svb_decoder() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return svb_decode_avx2;
+  if (__builtin_cpu_supports("ssse3"))
+    return svb_decode_ssse3;
+#endif
+  return svb_decode_scalar;
+}
+
+// Źródło - wydaje zdekodowane bloki. Bufor data musi istnieć, dopóki istnieje
+// generator. Bez podanego dekodera stream-vbyte wybierany jest najszybszy
+// obsługiwany przez procesor.
+inline p3::Generator<std::vector<std::uint32_t>>
+decode(const std::uint8_t *data, std::size_t size, codec c,
+       svb_decoder svb_decode = nullptr) {
+  if (!svb_decode)
+    svb_decode = best_svb_decoder();
+  const std::uint8_t *end = data + size;
+  while (end - data >= 8) {
+    std::size_t n = get32(data), bytes = get32(data + 4);
+    data += 8;
+    if (std::size_t(end - data) < bytes || n > block_size)
+      corrupt();
+    std::vector<std::uint32_t> batch(n);
+    if (c == codec::varint) {
+      decode_varint(data, data + bytes, n, batch.data());
+    } else {
+      // Dekodery ufają bajtom sterującym, więc przed ich wywołaniem
+      // sprawdzamy, że opisana nimi długość danych zgadza się z nagłówkiem.
+      std::size_t control = (n + 3) / 4;
+      if (control > bytes || svb_data_length(data, n) != bytes - control)
+        corrupt();
+      svb_decode(data, data + control, data + bytes, n, batch.data());
+    }
+    data += bytes;
+    co_yield std::move(batch);
+  }
+  // Reszta krótsza niż nagłówek bloku to obcięte albo uszkodzone dane.
+  if (data != end)
+    corrupt();
+}
+
+// Rosnący ciąg o przeważnie małych, czasem dużych odstępach.
+p3::Generator<std::uint32_t> ids(std::size_t count) {
+  std::uint32_t id = 0;
+  for (auto x : p21::random_values(count)) {
+    id += x % 64 == 0 ? x % 100000 : x % 200;
+    co_yield id;
+  }
+}
+
+auto main() -> void {
+  constexpr std::size_t n = 1 << 22;
+  std::vector<std::uint32_t> expected;
+  expected.reserve(n);
+  for (auto v : ids(n))
+    expected.push_back(v);
+
+  auto varint = encode(ids(n), codec::varint);
+  auto vbyte = encode(ids(n), codec::stream_vbyte);
+  std::cout << "main: varint " << double(varint.size()) / n
+            << " bytes/value, stream-vbyte " << double(vbyte.size()) / n
+            << " bytes/value" << std::endl;
+
+  auto run = [&](const std::string &name,
+                 const std::vector<std::uint8_t> &data, codec c,
+                 svb_decoder decoder) {
+    bool ok = true;
+    p14::benchmark(name, n, [&](std::size_t) {
+      std::size_t i = 0;
+      for (auto &&batch : decode(data.data(), data.size(), c, decoder)) {
+        ok = ok && std::equal(batch.begin(), batch.end(),
+                              expected.begin() + std::ptrdiff_t(i));
+        i += batch.size();
+      }
+      ok = ok && i == n;
+    });
+    if (!ok)
+      std::cout << name << ": FAILED" << std::endl;
+  };
+  run("varint", varint, codec::varint, nullptr);
+  run("stream-vbyte scalar", vbyte, codec::stream_vbyte, svb_decode_scalar);
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("ssse3"))
+    run("stream-vbyte ssse3", vbyte, codec::stream_vbyte, svb_decode_ssse3);
+  if (__builtin_cpu_supports("avx2"))
+    run("stream-vbyte avx2", vbyte, codec::stream_vbyte, svb_decode_avx2);
+#endif
+
+  // Uszkodzone bloki: sześciobajtowy varint, bajt sterujący zapowiadający
+  // więcej danych, niż jest w bloku, i niepełny nagłówek za ostatnim blokiem.
+  std::vector<std::uint8_t> long_varint = {1, 0, 0, 0, 6, 0, 0, 0,
+                                           0xff, 0xff, 0xff, 0xff, 0xff, 1};
+  std::vector<std::uint8_t> short_vbyte = {4, 0, 0, 0, 5, 0, 0, 0,
+                                           0xff, 1, 2, 3, 4};
+  std::vector<std::uint8_t> trailing(varint.begin(), varint.end());
+  trailing.insert(trailing.end(), {1, 0, 0});
+  for (auto [data, c] : {std::pair{&long_varint, codec::varint},
+                         std::pair{&short_vbyte, codec::stream_vbyte},
+                         std::pair{&trailing, codec::varint}}) {
+    try {
+      for (auto &&batch : decode(data->data(), data->size(), c)) {
+        (void)batch;
+      }
+      std::cout << "main: corrupt block accepted: FAILED" << std::endl;
+    } catch (const std::runtime_error &e) {
+      std::cout << "main: corrupt block: " << e.what() << std::endl;
+    }
+  }
+}
+} // namespace p24
+
+// 25. Przykład - kompresja blokowa w stylu LZ jako etapy potoku generatorów.
+//
+// Format bloku jest wzorowany na LZ4: ciąg sekwencji, z których każda to
+// bajt tokenu (4 bity długości literałów, 4 bity długości dopasowania minus
+// min_match), literały, 2-bajtowe przesunięcie wstecz i kopiowanie
+// dopasowania. Długości nie mieszczące się w 4 bitach są kontynuowane bajtami
+// po 255. Ostatnia sekwencja ma tylko literały. Dopasowania znajduje tablica
+// skrótów 4-bajtowych ciągów z ostatnimi pozycjami ich wystąpień.
+//
+// Strumień skompresowany to ramki: długość danych ramki, długość bloku po
+// dekompresji (po 4 bajty, little-endian) i dane. Blok, którego nie opłaca się
+// kompresować, zapisywany jest bez zmian (obie długości są wtedy równe).
+//
+// compress kompresuje bloki równolegle na planiście z p4, a decompress
+// dekompresuje je na osobnym wątku, wyprzedzając konsumenta o kilka bloków
+// (run_ahead).
+namespace p25 {
+
+using chunk = std::vector<std::uint8_t>;
+
+inline constexpr std::size_t block_size = 64 << 10;
+inline constexpr std::size_t min_match = 4;
+inline constexpr std::size_t max_offset = 65535;
+inline constexpr unsigned hash_bits = 12;
+// Dopasowania nie sięgają ostatnich bajtów bloku, więc porównania po 4 bajty
+// nigdy nie wychodzą poza blok.
+inline constexpr std::size_t tail_literals = 8;
+
+inline std::uint32_t load32(const std::uint8_t *p) {
+  std::uint32_t v;
+  std::memcpy(&v, p, sizeof v);
+  return v;
+}
+
+inline void put_length(chunk &out, std::size_t length) {
+  for (; length >= 255; length -= 255)
+    out.push_back(255);
+  out.push_back(std::uint8_t(length));
+}
+
+inline void put_sequence(chunk &out, const std::uint8_t *literals,
+                         std::size_t literal_length, std::size_t offset,
+                         std::size_t match_length) {
+  std::size_t match_code = match_length ? match_length - min_match : 0;
+  out.push_back(std::uint8_t(std::min<std::size_t>(literal_length, 15) << 4 |
+                             std::min<std::size_t>(match_code, 15)));
+  if (literal_length >= 15)
+    put_length(out, literal_length - 15);
+  out.insert(out.end(), literals, literals + literal_length);
+  if (match_length == 0)
+    return;
+  out.push_back(std::uint8_t(offset));
+  out.push_back(std::uint8_t(offset >> 8));
+  if (match_code >= 15)
+    put_length(out, match_code - 15);
+}
+
+// Dopisuje do out skompresowany blok (bez nagłówka ramki).
+inline void compress_block(const std::uint8_t *src, std::size_t n, chunk &out) {
+  std::array<std::uint32_t, 1 << hash_bits> table{};
+  auto hash = [](std::uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - hash_bits);
+  };
+  std::size_t anchor = 0, i = 0;
+  const std::size_t limit = n > tail_literals ? n - tail_literals : 0;
+  while (i + min_match <= limit) {
+    std::uint32_t seq = load32(src + i);
+    std::size_t candidate = std::exchange(table[hash(seq)], std::uint32_t(i));
+    if (candidate < i && i - candidate <= max_offset &&
+        load32(src + candidate) == seq) {
+      std::size_t length = min_match;
+      while (i + length < limit && src[candidate + length] == src[i + length])
+        length++;
+      put_sequence(out, src + anchor, i - anchor, i - candidate, length);
+      i += length;
+      anchor = i;
+    } else {
+      // Im dłużej nie ma dopasowań, tym większe kroki (jak w LZ4).
+      i += 1 + ((i - anchor) >> 6);
+    }
+  }
+  put_sequence(out, src + anchor, n - anchor, 0, 0);
+}
+
+[[noreturn]] inline void corrupt() {
+  throw std::runtime_error("lz: corrupt block");
+}
+
+// Każda długość literałów i dopasowania oraz każde przesunięcie jest
+// sprawdzane względem src i dst, więc uszkodzony blok kończy się wyjątkiem,
+// a nie odczytem lub zapisem poza buforami.
+inline void decompress_block(const std::uint8_t *src, std::size_t n,
+                             std::uint8_t *dst, std::size_t raw) {
+  const std::uint8_t *end = src + n;
+  std::size_t written = 0;
+  auto length = [&](std::size_t base) {
+    if (base < 15)
+      return base;
+    for (std::uint8_t byte = 255; byte == 255; base += byte) {
+      if (src == end)
+        corrupt();
+      byte = *src++;
+    }
+    return base;
+  };
+  while (src != end) {
+    std::uint8_t token = *src++;
+    std::size_t literals = length(token >> 4);
+    if (std::size_t(end - src) < literals || raw - written < literals)
+      corrupt();
+    std::memcpy(dst + written, src, literals);
+    src += literals;
+    written += literals;
+    if (src == end)
+      break;
+    if (end - src < 2)
+      corrupt();
+    std::size_t offset = src[0] | std::size_t(src[1]) << 8;
+    src += 2;
+    std::size_t match = length(token & 15) + min_match;
+    if (offset == 0 || offset > written || raw - written < match)
+      corrupt();
+    // Dopasowanie może nachodzić na kopiowane właśnie bajty, więc kopiujemy
+    // po 8 bajtów tylko, jeżeli źródło jest co najmniej tyle bajtów wstecz.
+    std::uint8_t *out = dst + written;
+    std::size_t k = 0;
+    if (offset >= 8)
+      for (; k + 8 <= match; k += 8)
+        std::memcpy(out + k, out + k - offset, 8);
+    for (; k < match; k++)
+      out[k] = out[k - offset];
+    written += match;
+  }
+  if (written != raw)
+    corrupt();
+}
+
+inline void put32(chunk &out, std::size_t at, std::size_t v) {
+  for (int i = 0; i < 4; i++)
+    out[at + i] = std::uint8_t(v >> (8 * i));
+}
+inline std::size_t get32(const std::uint8_t *p) {
+  return std::size_t(p[0]) | std::size_t(p[1]) << 8 | std::size_t(p[2]) << 16 |
+         std::size_t(p[3]) << 24;
+}
+
+// Ramka z blokiem - skompresowanym albo, jeżeli to nic nie daje, surowym.
+inline chunk frame(const chunk &raw) {
+  chunk out(8);
+  compress_block(raw.data(), raw.size(), out);
+  if (out.size() - 8 >= raw.size()) {
+    out.resize(8);
+    out.insert(out.end(), raw.begin(), raw.end());
+  }
+  put32(out, 0, out.size() - 8);
+  put32(out, 4, raw.size());
+  return out;
+}
+
+// Dzieli strumień kawałków dowolnej długości na bloki po size bajtów.
+inline p3::Generator<chunk> rechunk(p3::Generator<chunk> input,
+                                    std::size_t size) {
+  chunk block;
+  block.reserve(size);
+  for (auto &&c : input) {
+    for (std::size_t pos = 0; pos < c.size();) {
+      std::size_t n = std::min(size - block.size(), c.size() - pos);
+      block.insert(block.end(), c.begin() + std::ptrdiff_t(pos),
+                   c.begin() + std::ptrdiff_t(pos + n));
+      pos += n;
+      if (block.size() == size) {
+        co_yield std::move(block);
+        block.clear();
+        block.reserve(size);
+      }
+    }
+  }
+  if (!block.empty())
+    co_yield std::move(block);
+}
+
+inline p4::task compress_task(const chunk &raw, chunk &out) {
+  out = frame(raw);
+  co_return;
+}
+
+// Etap kompresji: wydaje ramki w kolejności bloków wejścia. Bloki kompresowane
+// są paczkami po kilka na wątek, na tych samych wątkach planisty dla
+// wszystkich paczek.
+inline p3::Generator<chunk> compress(p3::Generator<chunk> input,
+                                     std::size_t threads) {
+  auto blocks = rechunk(std::move(input), block_size);
+  std::vector<chunk> raw, framed;
+  p4::scheduler sched;
+  sched.start(threads);
+  while (blocks) {
+    raw.clear();
+    while (raw.size() < 4 * threads && blocks)
+      raw.push_back(blocks());
+    framed.assign(raw.size(), {});
+    std::vector<p4::task> tasks;
+    for (std::size_t i = 0; i < raw.size(); i++)
+      tasks.push_back(compress_task(raw[i], framed[i]));
+    for (auto &t : tasks)
+      sched.spawn(t);
+    sched.run();
+    for (auto &t : tasks)
+      t.get();
+    for (auto &f : framed)
+      co_yield std::move(f);
+  }
+}
+
+// Dekompresuje ramki z kawałków dowolnej długości.
+inline p3::Generator<chunk> decompress_blocks(p3::Generator<chunk> input) {
+  chunk pending;
+  for (auto &&c : input) {
+    pending.insert(pending.end(), c.begin(), c.end());
+    std::size_t pos = 0;
+    while (pending.size() - pos >= 8) {
+      std::size_t packed = get32(&pending[pos]), raw = get32(&pending[pos + 4]);
+      // Długości z nagłówka sprawdzamy przed alokacją bloku - blok nigdy nie
+      // jest większy niż block_size, a zapisany bez zmian nie jest dłuższy
+      // niż po dekompresji.
+      if (raw == 0 || raw > block_size || packed > raw)
+        corrupt();
+      if (pending.size() - pos - 8 < packed)
+        break;
+      const std::uint8_t *src = &pending[pos + 8];
+      chunk block(raw);
+      if (packed == raw)
+        std::copy_n(src, raw, block.begin());
+      else
+        decompress_block(src, packed, block.data(), raw);
+      pos += 8 + packed;
+      co_yield std::move(block);
+    }
+    pending.erase(pending.begin(), pending.begin() + std::ptrdiff_t(pos));
+  }
+  if (!pending.empty())
+    throw std::runtime_error("lz: truncated stream");
+}
+
+// Wykonuje generator na osobnym wątku, który wyprzedza konsumenta
+// o co najwyżej depth wartości. Wyjątki generatora trafiają do konsumenta.
+template <typename T>
+p3::Generator<T> run_ahead(p3::Generator<T> gen, std::size_t depth) {
+  std::mutex mutex;
+  std::condition_variable_any cv;
+  std::deque<T> queue;
+  bool done = false;
+  std::exception_ptr error;
+  std::jthread producer([&](std::stop_token stop) {
+    try {
+      for (auto &&v : gen) {
+        std::unique_lock lock(mutex);
+        if (!cv.wait(lock, stop, [&] { return queue.size() < depth; }))
+          return; // Konsument został zniszczony.
+        queue.push_back(std::move(v));
+        cv.notify_all();
+      }
+    } catch (...) {
+      std::lock_guard lock(mutex);
+      error = std::current_exception();
+    }
+    std::lock_guard lock(mutex);
+    done = true;
+    cv.notify_all();
+  });
+
+  while (true) {
+    T value;
+    {
+      std::unique_lock lock(mutex);
+      cv.wait(lock, [&] { return !queue.empty() || done; });
+      if (queue.empty()) {
+        if (error)
+          std::rethrow_exception(error);
+        break;
+      }
+      value = std::move(queue.front());
+      queue.pop_front();
+      cv.notify_all();
+    }
+    co_yield std::move(value);
+  }
+}
+
+// Etap dekompresji z wyprzedzaniem o depth bloków (0 - bez wyprzedzania).
+inline p3::Generator<chunk> decompress(p3::Generator<chunk> input,
+                                       std::size_t depth = 2) {
+  if (depth == 0)
+    return decompress_blocks(std::move(input));
+  return run_ahead(decompress_blocks(std::move(input)), depth);
+}
+
+// Kawałki bufora data (który musi istnieć, dopóki istnieje generator).
+inline p3::Generator<chunk> chunks(const std::uint8_t *data, std::size_t size,
+                                   std::size_t chunk_size) {
+  for (std::size_t pos = 0; pos < size; pos += chunk_size)
+    co_yield chunk(data + pos, data + std::min(size, pos + chunk_size));
+}
+
+// Dane podobne do tekstowego zapisu rekordów z p23.
+chunk text(std::size_t records) {
+  std::ostringstream out;
+  for (auto t : p23::trades(records))
+    out << t.time_ << ' ' << t.price_ << ' ' << t.symbol_ << '\n';
+  auto s = out.str();
+  return chunk(s.begin(), s.end());
+}
+
+auto main() -> void {
+  using ms = std::chrono::duration<double, std::milli>;
+  const std::size_t threads =
+      std::max<std::size_t>(2, std::thread::hardware_concurrency());
+  const chunk data = text(1 << 18);
+  const double mb = double(data.size()) / 1e6;
+
+  std::vector<chunk> compressed;
+  for (std::size_t t : {std::size_t(1), threads}) {
+    compressed.clear();
+    auto start = std::chrono::steady_clock::now();
+    for (auto &&f : compress(chunks(data.data(), data.size(), 10000), t))
+      compressed.push_back(std::move(f));
+    std::cout << "main: compress on " << t << " thread(s): "
+              << mb / (ms(std::chrono::steady_clock::now() - start).count() /
+                       1000)
+              << " MB/s" << std::endl;
+  }
+  chunk stream;
+  for (auto &f : compressed)
+    stream.insert(stream.end(), f.begin(), f.end());
+  std::cout << "main: ratio " << double(data.size()) / double(stream.size())
+            << std::endl;
+
+  for (std::size_t depth : {0, 2}) {
+    auto start = std::chrono::steady_clock::now();
+    chunk out;
+    for (auto &&block :
+         decompress(chunks(stream.data(), stream.size(), 4096), depth))
+      out.insert(out.end(), block.begin(), block.end());
+    std::cout << "main: decompress with run-ahead " << depth << ": "
+              << mb / (ms(std::chrono::steady_clock::now() - start).count() /
+                       1000)
+              << " MB/s: " << (out == data ? "ok" : "FAILED") << std::endl;
+  }
+
+  // Dane losowe się nie kompresują - bloki zapisywane są bez zmian.
+  chunk noise;
+  for (auto v : p21::random_values(1 << 15))
+    for (int i = 0; i < 8; i++)
+      noise.push_back(std::uint8_t(v >> (8 * i)));
+  chunk packed, unpacked;
+  for (auto &&f : compress(chunks(noise.data(), noise.size(), 1000), threads))
+    packed.insert(packed.end(), f.begin(), f.end());
+  for (auto &&block : decompress(chunks(packed.data(), packed.size(), 777)))
+    unpacked.insert(unpacked.end(), block.begin(), block.end());
+  std::cout << "main: random data " << noise.size() << " -> " << packed.size()
+            << " bytes: " << (unpacked == noise ? "ok" : "FAILED") << std::endl;
+
+  // Uszkodzone ramki: ogromna długość w nagłówku i przesunięcie dopasowania
+  // sięgające przed początek bloku.
+  chunk huge = {1, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0};
+  chunk bad_offset = {3, 0, 0, 0, 16, 0, 0, 0, 0x00, 1, 0};
+  for (const chunk *c : {&huge, &bad_offset}) {
+    try {
+      for (auto &&block : decompress(chunks(c->data(), c->size(), 4))) {
+        (void)block;
+      }
+      std::cout << "main: corrupt frame accepted: FAILED" << std::endl;
+    } catch (const std::runtime_error &e) {
+      std::cout << "main: corrupt frame: " << e.what() << std::endl;
+    }
+  }
+}
+} // namespace p25
+
+// 26. Przykład - przyrostowy tokenizer JSON (w stylu SAX) nad strumieniem
+// kawałków tekstu.
+//
+// tokenize pobiera kolejne kawałki dokumentu z generatora wejściowego tylko
+// wtedy, gdy skończy się bieżący - czyli zawiesza się na granicy kawałka do
+// czasu, aż źródło (np. odczyt z sieci) wyda następny. Tokeny wskazują
+// (string_view) bezpośrednio na tekst w bieżącym kawałku; tylko token
+// przecinający granicę kawałków jest kopiowany do bufora. Tekst tokenu jest
+// ważny do następnego wznowienia tokenizera. Napisy są wydawane bez
+// cudzysłowów i z nierozwiniętymi sekwencjami ucieczki.
+//
+// Odstępy oraz wnętrza napisów przeglądane są po 16 bajtów instrukcjami SSE2
+// (porównanie z kilkoma znakami naraz i movemask).
+namespace p26 {
+
+enum class kind : std::uint8_t {
+  begin_object,
+  end_object,
+  begin_array,
+  end_array,
+  key,
+  string,
+  number,
+  boolean,
+  null,
+};
+
+inline constexpr std::array<std::string_view, 9> kind_names = {
+    "begin_object", "end_object", "begin_array", "end_array", "key",
+    "string",       "number",     "boolean",     "null",
+};
+
+struct token {
+  kind kind_;
+  std::string_view text_;
+};
+
+[[noreturn]] inline void error(const char *what) {
+  throw std::runtime_error(std::string("json: ") + what);
+}
+
+inline bool is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+inline bool is_word(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') || c == '-' || c == '+' || c == '.';
+}
+
+// Pierwsza pozycja od i, która nie jest odstępem (albo n).
+template <bool Simd> std::size_t skip_space(const char *s, std::size_t i,
+                                            std::size_t n) {
+  // Odstępy między tokenami są zwykle krótkie albo ich nie ma.
+  if (i < n && !is_space(s[i]))
+    return i;
+#if defined(__SSE2__)
+  if constexpr (Simd) {
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+      __m128i space = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                       _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+          _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                       _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+      if (unsigned other = ~unsigned(_mm_movemask_epi8(space)) & 0xffff)
+        return i + std::countr_zero(other);
+    }
+  }
+#endif
+  while (i < n && is_space(s[i]))
+    i++;
+  return i;
+}
+
+// Pierwszy cudzysłów albo ukośnik wsteczny od i (albo n).
+template <bool Simd>
+std::size_t find_quote(const char *s, std::size_t i, std::size_t n) {
+#if defined(__SSE2__)
+  if constexpr (Simd) {
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+      __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+      if (unsigned mask = unsigned(_mm_movemask_epi8(special)))
+        return i + std::countr_zero(mask);
+    }
+  }
+#endif
+  while (i < n && s[i] != '"' && s[i] != '\\')
+    i++;
+  return i;
+}
+
+// Bieżący kawałek wejścia i bufor na tokeny przecinające granice kawałków.
+template <bool Simd> class reader {
+public:
+  explicit reader(p3::Generator<std::string> input)
+      : input_(std::move(input)) {}
+
+  // Przechodzi do następnego znaku, który nie jest odstępem. Zwraca false na
+  // końcu wejścia.
+  bool skip_space() {
+    while ((pos_ = p26::skip_space<Simd>(chunk_.data(), pos_, chunk_.size())) ==
+           chunk_.size())
+      if (!next())
+        return false;
+    return true;
+  }
+
+  char peek() const { return chunk_[pos_]; }
+  void advance() { pos_++; }
+
+  // Zawartość napisu; pos_ wskazuje na otwierający cudzysłów.
+  std::string_view string() {
+    std::size_t start = ++pos_;
+    bool spilled = false;
+    while (true) {
+      std::size_t i = find_quote<Simd>(chunk_.data(), pos_, chunk_.size());
+      if (i + 1 < chunk_.size() && chunk_[i] == '\\') {
+        pos_ = i + 2;
+        continue;
+      }
+      if (i < chunk_.size() && chunk_[i] == '"') {
+        pos_ = i + 1;
+        if (!spilled)
+          return std::string_view(chunk_).substr(start, i - start);
+        spill_.append(chunk_, start, i - start);
+        return spill_;
+      }
+      // Koniec kawałka - także zaraz po ukośniku, wtedy następny znak
+      // (z następnego kawałka) jest pomijany.
+      bool escape = i < chunk_.size();
+      spill(start, spilled);
+      if (!next())
+        error("unterminated string");
+      start = 0;
+      pos_ = escape ? 1 : 0;
+    }
+  }
+
+  // Liczba albo literał (true, false, null).
+  std::string_view word() {
+    std::size_t start = pos_;
+    bool spilled = false;
+    while (true) {
+      while (pos_ < chunk_.size() && is_word(chunk_[pos_]))
+        pos_++;
+      if (pos_ < chunk_.size()) {
+        if (!spilled)
+          return std::string_view(chunk_).substr(start, pos_ - start);
+        spill_.append(chunk_, start, pos_ - start);
+        return spill_;
+      }
+      spill(start, spilled);
+      if (!next())
+        return spill_;
+      start = 0;
+    }
+  }
+
+private:
+  void spill(std::size_t start, bool &spilled) {
+    if (!spilled)
+      spill_.clear();
+    spill_.append(chunk_, start);
+    spilled = true;
+  }
+
+  // Pobiera następny niepusty kawałek.
+  bool next() {
+    do {
+      if (!input_)
+        return false;
+      chunk_ = input_();
+    } while (chunk_.empty());
+    pos_ = 0;
+    return true;
+  }
+
+  p3::Generator<std::string> input_;
+  std::string chunk_;
+  std::size_t pos_ = 0;
+  std::string spill_;
+};
+
+inline token classify(std::string_view word) {
+  if (word == "true" || word == "false")
+    return {kind::boolean, word};
+  if (word == "null")
+    return {kind::null, word};
+  if (!word.empty() && (word[0] == '-' || (word[0] >= '0' && word[0] <= '9')))
+    return {kind::number, word};
+  error("unexpected literal");
+}
+
+template <bool Simd = true>
+p3::Generator<token> tokenize(p3::Generator<std::string> input) {
+  reader<Simd> in(std::move(input));
+  std::vector<char> open; // Otwarte '{' i '['.
+  bool expect_key = false;
+  while (in.skip_space()) {
+    switch (char c = in.peek()) {
+    case '{':
+    case '[':
+      in.advance();
+      open.push_back(c);
+      expect_key = c == '{';
+      co_yield token{c == '{' ? kind::begin_object : kind::begin_array, {}};
+      break;
+    case '}':
+    case ']':
+      if (open.empty() || open.back() != (c == '}' ? '{' : '['))
+        error("mismatched bracket");
+      in.advance();
+      open.pop_back();
+      expect_key = false;
+      co_yield token{c == '}' ? kind::end_object : kind::end_array, {}};
+      break;
+    case ',':
+      in.advance();
+      expect_key = !open.empty() && open.back() == '{';
+      break;
+    case ':':
+      in.advance();
+      break;
+    case '"': {
+      kind k = expect_key ? kind::key : kind::string;
+      expect_key = false;
+      co_yield token{k, in.string()};
+      break;
+    }
+    default:
+      if (!is_word(c))
+        error("unexpected character");
+      co_yield classify(in.word());
+    }
+  }
+  if (!open.empty())
+    error("unexpected end of input");
+}
+
+// Kawałki napisu po size bajtów (napis musi istnieć, dopóki istnieje
+// generator).
+inline p3::Generator<std::string> chunks(std::string_view text,
+                                         std::size_t size) {
+  for (std::size_t pos = 0; pos < text.size(); pos += size)
+    co_yield std::string(text.substr(pos, size));
+}
+
+inline std::string document(std::size_t items) {
+  std::ostringstream out;
+  out << "[\n";
+  for (std::size_t i = 0; i < items; i++) {
+    out << (i ? ",\n" : "") << "  {\n"
+        << "    \"id\": " << i << ",\n"
+        << "    \"name\": \"item \\\"" << i << "\\\" of the catalogue\",\n"
+        << "    \"tags\": [\"red\", \"green\", \"blue\"],\n"
+        << "    \"price\": " << i % 1000 << "." << i % 97 << ",\n"
+        << "    \"active\": " << (i % 2 ? "true" : "false") << ",\n"
+        << "    \"note\": null\n"
+        << "  }";
+  }
+  out << "\n]\n";
+  return out.str();
+}
+
+// Skrót strumienia tokenów, do porównania wyników.
+template <bool Simd> std::uint64_t digest(std::string_view text,
+                                          std::size_t chunk_size) {
+  std::uint64_t h = 0;
+  for (auto t : tokenize<Simd>(chunks(text, chunk_size))) {
+    h = p22::mix(h + std::uint64_t(t.kind_));
+    for (char c : t.text_)
+      h = h * 31 + std::uint8_t(c);
+  }
+  return h;
+}
+
+auto main() -> void {
+  const char *sample =
+      R"({"name": "zpr", "tags": ["a\"b", 1.5e3], "ok": true})";
+  for (auto t : tokenize(chunks(sample, 7)))
+    std::cout << kind_names[std::size_t(t.kind_)]
+              << (t.text_.empty() ? "" : " ") << t.text_ << std::endl;
+
+  const std::string small = document(100);
+  const std::uint64_t expected = digest<false>(small, small.size());
+  bool ok = true;
+  for (std::size_t size : {1, 2, 3, 5, 16, 17, 4096})
+    ok = ok && digest<true>(small, size) == expected &&
+         digest<false>(small, size) == expected;
+  std::cout << "main: chunk boundaries: " << (ok ? "ok" : "FAILED")
+            << std::endl;
+
+  const std::string big = document(1 << 17);
+  auto run = [&](const char *name, auto tokenizer) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t tokens = 0;
+    for (auto t : tokenizer(chunks(big, 64 << 10))) {
+      (void)t;
+      tokens++;
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "main: " << name << ": " << tokens << " tokens, "
+              << double(big.size()) / elapsed.count() / 1e9 << " GB/s"
+              << std::endl;
+  };
+  run("scalar", [](auto input) { return tokenize<false>(std::move(input)); });
+  run("sse2", [](auto input) { return tokenize<true>(std::move(input)); });
+}
+} // namespace p26
+
+// 27. Przykład - przyrostowy parser HTTP/1.1 i serwer na pętli epoll.
+//
+// http_parser to coroutine wznawiana każdym odebranym kawałkiem danych
+// (feed). Stan parsowania - bieżąca linia, nagłówki, brakująca część ciała -
+// zostaje w ramce coroutine między wywołaniami, więc każdy bajt jest
+// przeglądany tylko raz, bez ponownego parsowania całego bufora. Kompletne
+// komunikaty (także kilka z jednego kawałka, gdy klient wysyła je potokowo)
+// trafiają do wektora wyjściowego. Ten sam parser czyta żądania w serwerze i
+// odpowiedzi w generatorze obciążenia - różnią się tylko znaczeniem pól
+// pierwszej linii.
+//
+// event_loop to minimalna jednowątkowa pętla zdarzeń na epoll: coroutine
+// czeka na gotowość gniazda (co_await loop.readable(fd)), a pętla wznawia ją,
+// gdy jądro zgłosi zdarzenie. Serwer obsługuje połączenia keep-alive, a
+// generator obciążenia na drugim wątku (z własną pętlą) otwiera kilkadziesiąt
+// połączeń przez interfejs loopback i mierzy przepustowość oraz opóźnienia.
+namespace p27 {
+
+struct message {
+  // Żądanie: metoda, cel, wersja. Odpowiedź: wersja, status, opis.
+  std::array<std::string, 3> start_line_;
+  std::vector<std::pair<std::string, std::string>> headers_;
+  std::string body_;
+  bool keep_alive_ = true;
+};
+
+[[noreturn]] inline void bad_message(const char *what) {
+  throw std::runtime_error(std::string("http: ") + what);
+}
+
+inline bool iequals(std::string_view a, std::string_view b) {
+  return std::ranges::equal(a, b, [](char x, char y) {
+    return std::tolower(static_cast<unsigned char>(x)) ==
+           std::tolower(static_cast<unsigned char>(y));
+  });
+}
+
+inline std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+    s.remove_suffix(1);
+  return s;
+}
+
+// Wywołuje f dla każdego niepustego elementu listy rozdzielanej przecinkami,
+// np. "keep-alive, Upgrade".
+template <typename F> void for_each_token(std::string_view list, F f) {
+  while (true) {
+    auto comma = list.find(',');
+    auto item = trim(list.substr(0, comma));
+    if (!item.empty())
+      f(item);
+    if (comma == std::string_view::npos)
+      break;
+    list.remove_prefix(comma + 1);
+  }
+}
+
+class message_parser {
+public:
+  struct promise_type {
+    std::string_view chunk_;
+    std::vector<message> *out_ = nullptr;
+    std::exception_ptr exception_;
+
+    message_parser get_return_object() {
+      return message_parser(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    // Coroutine od razu dochodzi do oczekiwania na pierwszy kawałek.
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    // Kompletny komunikat - parsowanie toczy się dalej bez zawieszania.
+    std::suspend_never yield_value(message &&m) {
+      out_->push_back(std::move(m));
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { exception_ = std::current_exception(); }
+  };
+
+  // Zawiesza parser do następnego wywołania feed i zwraca przekazany kawałek.
+  struct next_chunk {
+    promise_type *p_ = nullptr;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+      p_ = &h.promise();
+    }
+    std::string_view await_resume() const noexcept { return p_->chunk_; }
+  };
+
+  message_parser(const message_parser &) = delete;
+  message_parser &operator=(const message_parser &) = delete;
+  message_parser(message_parser &&other) noexcept
+      : h_(std::exchange(other.h_, nullptr)) {}
+  ~message_parser() {
+    if (h_)
+      h_.destroy();
+  }
+
+  // Przetwarza odebrany kawałek i dopisuje do out komunikaty, które się w nim
+  // zakończyły. Po błędzie (wyjątek) parser nie przyjmuje dalszych danych.
+  void feed(std::string_view chunk, std::vector<message> &out) {
+    if (h_.done())
+      throw std::logic_error("http: parser failed earlier");
+    auto &p = h_.promise();
+    p.chunk_ = chunk;
+    p.out_ = &out;
+    h_.resume();
+    if (p.exception_)
+      std::rethrow_exception(p.exception_);
+  }
+
+private:
+  explicit message_parser(std::coroutine_handle<promise_type> h) : h_(h) {}
+  std::coroutine_handle<promise_type> h_;
+};
+
+inline constexpr std::size_t max_line = 8192;
+inline constexpr std::size_t max_headers = 100;
+// Większe ciała odrzucamy, zanim zarezerwujemy na nie pamięć.
+inline constexpr std::size_t max_body = 1 << 20;
+
+// Coroutine zawiesza się tylko, gdy przetworzyła cały bieżący kawałek, więc
+// data nigdy nie wskazuje na kawałek z poprzedniego wywołania feed.
+inline message_parser http_parser() {
+  std::string_view data;
+  std::string line;
+  while (true) {
+    message m;
+    std::optional<std::size_t> content_length;
+    bool http10 = false, connection_close = false, connection_keep = false;
+    for (std::size_t lines = 0;; lines++) {
+      line.clear();
+      while (true) {
+        while (data.empty())
+          data = co_await message_parser::next_chunk{};
+        auto nl = data.find('\n');
+        if (line.size() + std::min(nl, data.size()) > max_line)
+          bad_message("line too long");
+        if (nl == std::string_view::npos) {
+          line.append(data);
+          data = {};
+          continue;
+        }
+        line.append(data.substr(0, nl));
+        data.remove_prefix(nl + 1);
+        break;
+      }
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+
+      if (lines == 0) {
+        std::string_view rest = line;
+        for (std::size_t i = 0; i < 2; i++) {
+          auto space = rest.find(' ');
+          if (space == std::string_view::npos)
+            bad_message("malformed start line");
+          m.start_line_[i] = rest.substr(0, space);
+          rest.remove_prefix(space + 1);
+        }
+        m.start_line_[2] = rest;
+        http10 = m.start_line_[0] == "HTTP/1.0" || rest == "HTTP/1.0";
+        continue;
+      }
+      if (line.empty())
+        break;
+      if (lines > max_headers)
+        bad_message("too many headers");
+      auto colon = line.find(':');
+      if (colon == std::string::npos || colon == 0)
+        bad_message("malformed header");
+      std::string_view name = std::string_view(line).substr(0, colon);
+      std::string_view value = trim(std::string_view(line).substr(colon + 1));
+      if (iequals(name, "content-length")) {
+        // Powtórzenia (w kolejnych nagłówkach albo jako lista) muszą się
+        // zgadzać - inaczej granica komunikatu byłaby niejednoznaczna.
+        if (value.empty())
+          bad_message("invalid content-length");
+        for_each_token(value, [&](std::string_view item) {
+          std::size_t length;
+          auto [end, ec] =
+              std::from_chars(item.data(), item.data() + item.size(), length);
+          if (ec != std::errc() || end != item.data() + item.size())
+            bad_message("invalid content-length");
+          if (content_length && *content_length != length)
+            bad_message("conflicting content-length");
+          if (length > max_body)
+            bad_message("body too large");
+          content_length = length;
+        });
+      } else if (iequals(name, "transfer-encoding")) {
+        bad_message("transfer-encoding is not supported");
+      } else if (iequals(name, "connection")) {
+        for_each_token(value, [&](std::string_view option) {
+          connection_close = connection_close || iequals(option, "close");
+          connection_keep = connection_keep || iequals(option, "keep-alive");
+        });
+      }
+      m.headers_.emplace_back(name, value);
+    }
+    m.keep_alive_ = http10 ? connection_keep : !connection_close;
+
+    std::size_t body_length = content_length.value_or(0);
+    m.body_.reserve(body_length);
+    while (m.body_.size() < body_length) {
+      while (data.empty())
+        data = co_await message_parser::next_chunk{};
+      auto n = std::min(data.size(), body_length - m.body_.size());
+      m.body_.append(data.substr(0, n));
+      data.remove_prefix(n);
+    }
+    co_yield std::move(m);
+  }
+}
+
+[[noreturn]] inline void fail(const char *what) { p21::fail(what); }
+
+// Deskryptor zamykany razem z właścicielem, także przy niszczeniu ramki
+// coroutine.
+class descriptor {
+public:
+  explicit descriptor(int fd) : fd_(fd) {}
+  descriptor(const descriptor &) = delete;
+  descriptor &operator=(const descriptor &) = delete;
+  descriptor(descriptor &&other) noexcept
+      : fd_(std::exchange(other.fd_, -1)) {}
+  ~descriptor() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+  int get() const { return fd_; }
+
+private:
+  int fd_;
+};
+
+// Coroutine wykonywana przez pętlę zdarzeń. Obiekt io_task jest właścicielem
+// ramki, a po detach() ramka zwalnia się sama po zakończeniu coroutine.
+//
+// Wyjątek kończy tylko tę coroutine: odłączona (obsługa połączenia) wypisuje
+// go i znika, a nieodłączoną właściciel sprawdza przez rethrow().
+class io_task {
+public:
+  static void report(std::exception_ptr e) {
+    try {
+      std::rethrow_exception(e);
+    } catch (const std::exception &x) {
+      std::cerr << "server: task failed: " << x.what() << std::endl;
+    } catch (...) {
+      std::cerr << "server: task failed" << std::endl;
+    }
+  }
+
+  struct promise_type {
+    bool detached_ = false;
+    std::exception_ptr exception_;
+
+    io_task get_return_object() {
+      return io_task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    struct final_awaiter : std::suspend_always {
+      bool detached_;
+      bool await_ready() const noexcept { return detached_; }
+    };
+    final_awaiter final_suspend() noexcept {
+      if (detached_ && exception_)
+        report(exception_);
+      return {{}, detached_};
+    }
+    void return_void() {}
+    void unhandled_exception() { exception_ = std::current_exception(); }
+  };
+
+  io_task(const io_task &) = delete;
+  io_task &operator=(const io_task &) = delete;
+  io_task(io_task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+  ~io_task() {
+    if (h_)
+      h_.destroy();
+  }
+
+  void detach() {
+    if (h_.done()) {
+      if (h_.promise().exception_)
+        report(h_.promise().exception_);
+      h_.destroy();
+    } else {
+      h_.promise().detached_ = true;
+    }
+    h_ = nullptr;
+  }
+
+  // Rzuca wyjątek, którym zakończyła się coroutine.
+  void rethrow() const {
+    if (h_.done() && h_.promise().exception_)
+      std::rethrow_exception(h_.promise().exception_);
+  }
+
+private:
+  explicit io_task(std::coroutine_handle<promise_type> h) : h_(h) {}
+  std::coroutine_handle<promise_type> h_;
+};
+
+class event_loop {
+public:
+  event_loop()
+      : epoll_(epoll_create1(EPOLL_CLOEXEC)),
+        wake_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (epoll_ < 0 || wake_ < 0)
+      fail("event_loop");
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &ev) != 0)
+      fail("event_loop: epoll_ctl");
+  }
+  event_loop(const event_loop &) = delete;
+  event_loop &operator=(const event_loop &) = delete;
+  ~event_loop() {
+    close(wake_);
+    close(epoll_);
+  }
+
+  // Jednorazowe (EPOLLONESHOT) oczekiwanie na zdarzenie events deskryptora.
+  struct awaiter {
+    event_loop &loop_;
+    int fd_;
+    std::uint32_t events_;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+      epoll_event ev{};
+      ev.events = events_ | EPOLLONESHOT;
+      ev.data.ptr = h.address();
+      if (epoll_ctl(loop_.epoll_, EPOLL_CTL_MOD, fd_, &ev) != 0 &&
+          (errno != ENOENT ||
+           epoll_ctl(loop_.epoll_, EPOLL_CTL_ADD, fd_, &ev) != 0))
+        fail("event_loop: epoll_ctl");
+    }
+    void await_resume() const noexcept {}
+  };
+  awaiter readable(int fd) { return {*this, fd, EPOLLIN}; }
+  awaiter writable(int fd) { return {*this, fd, EPOLLOUT}; }
+  // Nastawia zegar timer (timerfd) na delay i czeka, aż minie. Po wznowieniu
+  // trzeba odczytać z niego licznik, inaczej zegar zostaje gotowy.
+  awaiter sleep(int timer, std::chrono::nanoseconds delay) {
+    itimerspec spec{};
+    spec.it_value.tv_sec = std::time_t(delay.count() / 1000000000);
+    spec.it_value.tv_nsec = long(delay.count() % 1000000000);
+    if (timerfd_settime(timer, 0, &spec, nullptr) != 0)
+      fail("event_loop: timerfd_settime");
+    return readable(timer);
+  }
+
+  // Zgłasza zatrzymanie pętli; można wywołać z dowolnego wątku.
+  void stop() {
+    std::uint64_t one = 1;
+    [[maybe_unused]] auto n = write(wake_, &one, sizeof one);
+  }
+
+  // Wznawia gotowe coroutines, dopóki nie zgłoszono zatrzymania i idle() nie
+  // zwraca true - po zgłoszeniu pętla kończy jeszcze rozpoczęte sprawy.
+  template <typename Idle> void run(Idle idle) {
+    std::array<epoll_event, 64> events;
+    bool stopping = false;
+    while (!stopping || !idle()) {
+      int n = epoll_wait(epoll_, events.data(), int(events.size()), -1);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        fail("event_loop: epoll_wait");
+      }
+      for (int i = 0; i < n; i++) {
+        if (!events[std::size_t(i)].data.ptr) {
+          std::uint64_t count;
+          [[maybe_unused]] auto r = read(wake_, &count, sizeof count);
+          stopping = true;
+          continue;
+        }
+        std::coroutine_handle<>::from_address(events[std::size_t(i)].data.ptr)
+            .resume();
+      }
+    }
+  }
+
+private:
+  int epoll_;
+  int wake_;
+};
+
+inline std::string response(const message &request) {
+  std::string body = "Hello from " + request.start_line_[1] + "\n";
+  std::string out = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n";
+  if (!request.keep_alive_)
+    out += "Connection: close\r\n";
+  out += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+  return out + body;
+}
+
+// Obsługuje połączenie aż do zamknięcia przez klienta, błędu albo żądania
+// bez keep-alive. Gniazdo zamyka descriptor, a licznik open - open_guard, także
+// gdy coroutine kończy się wyjątkiem.
+io_task connection(event_loop &loop, descriptor sock, std::size_t &open) {
+  struct open_guard {
+    std::size_t &open_;
+    ~open_guard() { open_--; }
+  } guard{++open};
+  const int fd = sock.get();
+  auto parser = http_parser();
+  std::vector<message> requests;
+  std::array<char, 16384> buffer;
+  std::string out;
+  for (bool alive = true; alive;) {
+    ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      co_await loop.readable(fd);
+      continue;
+    }
+    if (n <= 0)
+      break;
+    bool bad = false;
+    try {
+      parser.feed(std::string_view(buffer.data(), std::size_t(n)), requests);
+    } catch (const std::runtime_error &) {
+      bad = true;
+    }
+    // Żądania za pierwszym bez keep-alive zostają bez odpowiedzi.
+    for (auto &request : requests) {
+      out += response(request);
+      if (!request.keep_alive_) {
+        alive = false;
+        break;
+      }
+    }
+    requests.clear();
+    if (bad && alive) {
+      out += "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n"
+             "Content-Length: 0\r\n\r\n";
+      alive = false;
+    }
+    // Odpowiedzi na wszystkie żądania z kawałka wysyłamy razem.
+    while (!out.empty()) {
+      ssize_t sent = send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        co_await loop.writable(fd);
+        continue;
+      }
+      if (sent < 0) {
+        alive = false;
+        break;
+      }
+      out.erase(0, std::size_t(sent));
+    }
+  }
+}
+
+// Błędy accept dotyczące tylko jednego połączenia: zerwanie przed przyjęciem
+// i błędy sieci, które accept(2) każe traktować jak EAGAIN.
+inline bool connection_error(int error) {
+  switch (error) {
+  case ECONNABORTED:
+  case EPROTO:
+  case ENETDOWN:
+  case ENOPROTOOPT:
+  case EHOSTDOWN:
+  case ENONET:
+  case EHOSTUNREACH:
+  case EOPNOTSUPP:
+  case ENETUNREACH:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Brak deskryptorów albo pamięci mija, gdy zamkną się inne połączenia.
+inline bool resource_error(int error) {
+  return error == EMFILE || error == ENFILE || error == ENOBUFS ||
+         error == ENOMEM;
+}
+
+io_task accept_loop(event_loop &loop, int listener, std::size_t &open) {
+  using namespace std::chrono_literals;
+  // Zegar tworzymy z góry - po EMFILE nie dałoby się go już otworzyć.
+  descriptor timer(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+  if (timer.get() < 0)
+    fail("server: timerfd_create");
+  std::chrono::milliseconds backoff = 1ms;
+  while (true) {
+    int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      int error = errno;
+      if (error == EAGAIN || error == EWOULDBLOCK) {
+        co_await loop.readable(listener);
+      } else if (resource_error(error)) {
+        // Połączenie czeka w kolejce; ponawiamy z coraz dłuższą przerwą.
+        std::cerr << "server: accept: " << std::strerror(error)
+                  << ", retrying in " << backoff.count() << " ms"
+                  << std::endl;
+        co_await loop.sleep(timer.get(), backoff);
+        std::uint64_t expirations;
+        [[maybe_unused]] auto r =
+            read(timer.get(), &expirations, sizeof expirations);
+        backoff = std::min(backoff * 2, std::chrono::milliseconds(1s));
+      } else if (connection_error(error)) {
+        std::cerr << "server: accept: " << std::strerror(error) << std::endl;
+      } else if (error != EINTR) {
+        fail("server: accept");
+      }
+      continue;
+    }
+    backoff = 1ms;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    connection(loop, descriptor(fd), open).detach();
+  }
+}
+
+// Nasłuchujące gniazdo na 127.0.0.1 i porcie wybranym przez system.
+inline int listen_loopback(sockaddr_in &addr) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    fail("server: socket");
+  addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof addr;
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) != 0 ||
+      listen(fd, SOMAXCONN) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+    fail("server: listen");
+  return fd;
+}
+
+// Jedno połączenie generatora obciążenia: requests żądań wysyłanych po kolei,
+// każde po odebraniu odpowiedzi na poprzednie.
+io_task client(event_loop &loop, sockaddr_in addr, std::size_t requests,
+               p13::histogram &latency, std::size_t &failed,
+               std::size_t &running) {
+  struct running_guard {
+    event_loop &loop_;
+    std::size_t &running_;
+    ~running_guard() {
+      if (--running_ == 0)
+        loop_.stop();
+    }
+  } guard{loop, running};
+  descriptor sock(
+      socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+  const int fd = sock.get();
+  if (fd < 0)
+    fail("client: socket");
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) != 0) {
+    if (errno != EINPROGRESS)
+      fail("client: connect");
+    co_await loop.writable(fd);
+    int error = 0;
+    socklen_t len = sizeof error;
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error != 0) {
+      errno = error;
+      fail("client: connect");
+    }
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+  const std::string_view request =
+      "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  auto parser = http_parser();
+  std::vector<message> responses;
+  std::array<char, 4096> buffer;
+  for (std::size_t i = 0; i < requests; i++) {
+    auto start = p4::scheduler::now_ns();
+    for (std::string_view out = request; !out.empty();) {
+      ssize_t sent = send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        co_await loop.writable(fd);
+        continue;
+      }
+      if (sent < 0)
+        fail("client: send");
+      out.remove_prefix(std::size_t(sent));
+    }
+    while (responses.empty()) {
+      ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        co_await loop.readable(fd);
+        continue;
+      }
+      if (n <= 0)
+        fail("client: recv");
+      parser.feed(std::string_view(buffer.data(), std::size_t(n)), responses);
+    }
+    latency.record(std::uint64_t(p4::scheduler::now_ns() - start));
+    if (responses.front().start_line_[1] != "200")
+      failed++;
+    responses.clear();
+  }
+}
+
+// Wysyła w potoku żądanie z Connection: close i drugie za nim, po czym liczy
+// odpowiedzi odebrane do zamknięcia połączenia przez serwer.
+inline std::size_t pipelined_close(sockaddr_in addr) {
+  descriptor sock(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  if (sock.get() < 0 || connect(sock.get(), reinterpret_cast<sockaddr *>(&addr),
+                                sizeof addr) != 0)
+    fail("client: connect");
+  const std::string_view requests =
+      "GET /a HTTP/1.1\r\nConnection: close\r\n\r\nGET /b HTTP/1.1\r\n\r\n";
+  if (send(sock.get(), requests.data(), requests.size(), MSG_NOSIGNAL) !=
+      ssize_t(requests.size()))
+    fail("client: send");
+  auto parser = http_parser();
+  std::vector<message> responses;
+  std::array<char, 4096> buffer;
+  ssize_t n;
+  while ((n = recv(sock.get(), buffer.data(), buffer.size(), 0)) > 0)
+    parser.feed(std::string_view(buffer.data(), std::size_t(n)), responses);
+  return responses.size();
+}
+
+inline std::uint64_t percentile(const p13::histogram &h, double p) {
+  std::array<std::uint64_t, p13::histogram::buckets> counts{};
+  h.add_to(counts);
+  std::uint64_t total = 0;
+  for (auto n : counts)
+    total += n;
+  auto target = std::max<std::uint64_t>(1, std::uint64_t(p * double(total)));
+  std::uint64_t seen = 0;
+  std::size_t i = 0;
+  while ((seen += counts[i]) < target)
+    i++;
+  return p13::histogram::highest(i);
+}
+
+auto main() -> void {
+  // Dwa żądania w potoku, podane w całości i bajt po bajcie.
+  const std::string_view pipelined =
+      "POST /submit HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n\r\nhello"
+      "GET /next HTTP/1.0\r\nConnection: keep-alive\r\n\r\n";
+  for (std::size_t step : {pipelined.size(), std::size_t(1)}) {
+    auto parser = http_parser();
+    std::vector<message> out;
+    for (std::size_t pos = 0; pos < pipelined.size(); pos += step)
+      parser.feed(pipelined.substr(pos, step), out);
+    std::cout << "main: chunks of " << step << " byte(s):";
+    for (auto &m : out)
+      std::cout << " [" << m.start_line_[0] << ' ' << m.start_line_[1] << ' '
+                << m.start_line_[2] << ", " << m.headers_.size()
+                << " header(s), body '" << m.body_ << "', "
+                << (m.keep_alive_ ? "keep-alive" : "close") << "]";
+    std::cout << std::endl;
+  }
+
+  // Connection jako lista opcji i powtórzone Content-Length.
+  for (std::string_view text :
+       {"GET / HTTP/1.0\r\nConnection: keep-alive, Upgrade\r\n\r\n",
+        "GET / HTTP/1.1\r\nConnection: close, foo\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 2, 2\r\n"
+        "\r\nok",
+        "POST / HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 3\r\n"
+        "\r\nbad",
+        "POST / HTTP/1.1\r\nContent-Length: 18446744073709551615\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 1073741824\r\n\r\n"}) {
+    auto parser = http_parser();
+    std::vector<message> out;
+    try {
+      parser.feed(text, out);
+      std::cout << "main: " << out.front().start_line_[2] << ", body '"
+                << out.front().body_ << "', "
+                << (out.front().keep_alive_ ? "keep-alive" : "close")
+                << std::endl;
+    } catch (const std::runtime_error &e) {
+      std::cout << "main: " << e.what() << std::endl;
+    }
+  }
+
+  sockaddr_in addr;
+  int listener = listen_loopback(addr);
+  event_loop server;
+  std::size_t open = 0;
+  auto acceptor = accept_loop(server, listener, open);
+
+  constexpr std::size_t connections = 32, requests = 2000;
+  p13::histogram latency;
+  std::size_t failed = 0;
+  std::chrono::duration<double> elapsed;
+  std::size_t closed = 0;
+  std::jthread load([&] {
+    event_loop loop;
+    std::size_t running = connections;
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < connections; i++)
+      client(loop, addr, requests, latency, failed, running).detach();
+    loop.run([] { return true; });
+    elapsed = std::chrono::steady_clock::now() - start;
+    closed = pipelined_close(addr);
+    server.stop();
+  });
+  server.run([&] { return open == 0; });
+  load.join();
+  close(listener);
+  acceptor.rethrow();
+
+  std::cout << "main: " << connections * requests << " requests over "
+            << connections << " connections: "
+            << double(connections * requests) / elapsed.count()
+            << " req/s, p50 " << percentile(latency, 0.5) / 1000.0
+            << " us, p99 " << percentile(latency, 0.99) / 1000.0 << " us"
+            << (failed ? ", FAILED" : "") << std::endl;
+  std::cout << "main: pipelined after Connection: close: " << closed
+            << " response(s)" << std::endl;
+}
+} // namespace p27
+
+// 28. Przykład - lekser sterowany tablicą automatu zbudowanego w czasie
+// kompilacji.
+//
+// Tokeny opisujemy wyrażeniami regularnymi (token_spec). Funkcja constexpr
+// build tłumaczy je metodą Thompsona na automat niedeterministyczny, a ten
+// konstrukcją podzbiorów na automat deterministyczny (DFA). Wynikiem są
+// tablice: klasa każdego bajtu (bajty nieodróżniane przez żaden wzorzec mają
+// wspólną klasę, co zmniejsza tablicę przejść), przejścia stan x klasa i numer
+// tokenu akceptowanego w stanie. Błędny wzorzec jest błędem kompilacji.
+//
+// lex wydaje tokeny jako pary (rodzaj, string_view) wskazujące na bufor
+// wejściowy - bez kopiowania. Wybierane jest najdłuższe dopasowanie, a przy
+// równej długości - wcześniejsza specyfikacja (np. słowa kluczowe przed
+// identyfikatorami). Tokeny oznaczone skip (odstępy, komentarze) są pomijane.
+//
+// Obsługiwana składnia wzorców: znaki, '.', klasy [a-z] i [^...], sekwencje
+// \d \w \s \n \t \r i \<znak>, grupy (...), alternatywa | oraz *, + i ?.
+namespace p28 {
+
+struct token_spec {
+  std::string_view name_;
+  std::string_view pattern_;
+  bool skip_ = false;
+};
+
+struct token {
+  std::size_t kind_;
+  std::string_view text_;
+};
+
+// Zbiór bitów o stałym rozmiarze (std::bitset nie jest constexpr w C++20).
+template <std::size_t Bits> struct bit_set {
+  std::array<std::uint64_t, (Bits + 63) / 64> words_{};
+
+  constexpr void set(std::size_t i) {
+    words_[i / 64] |= std::uint64_t(1) << (i % 64);
+  }
+  constexpr bool test(std::size_t i) const {
+    return words_[i / 64] >> (i % 64) & 1;
+  }
+  constexpr bool empty() const {
+    for (auto w : words_)
+      if (w)
+        return false;
+    return true;
+  }
+  constexpr void flip() {
+    for (auto &w : words_)
+      w = ~w;
+  }
+  constexpr bool operator==(const bit_set &) const = default;
+};
+
+using byte_set = bit_set<256>;
+
+// Automat niedeterministyczny: stan ma przejście po zbiorze bajtów (chars_ do
+// out_) albo co najwyżej dwa przejścia puste.
+template <std::size_t MaxNfa> class nfa {
+public:
+  struct state {
+    byte_set chars_;
+    int out_ = -1;
+    int eps_[2] = {-1, -1};
+    int accept_ = -1;
+  };
+  struct fragment {
+    int start_;
+    int end_;
+  };
+
+  constexpr fragment add(std::string_view pattern, int kind) {
+    pattern_ = pattern;
+    pos_ = 0;
+    fragment f = alternation();
+    if (pos_ != pattern_.size())
+      error("unexpected ')'");
+    states_[std::size_t(f.end_)].accept_ = kind;
+    return f;
+  }
+
+  constexpr const state &operator[](std::size_t i) const { return states_[i]; }
+  constexpr std::size_t size() const { return size_; }
+
+private:
+  // W obliczeniu constexpr wyjątek oznacza błąd kompilacji.
+  [[noreturn]] static void error(const char *what) {
+    throw std::invalid_argument(std::string("lexer: ") + what);
+  }
+
+  constexpr int make() {
+    if (size_ == MaxNfa)
+      error("too many states");
+    return int(size_++);
+  }
+  constexpr state &at(int i) { return states_[std::size_t(i)]; }
+
+  constexpr void link(int from, int to) {
+    auto &eps = at(from).eps_;
+    (eps[0] < 0 ? eps[0] : eps[1]) = to;
+  }
+
+  constexpr bool more() const { return pos_ < pattern_.size(); }
+  constexpr char peek() const { return pattern_[pos_]; }
+
+  constexpr fragment alternation() {
+    fragment f = concatenation();
+    while (more() && peek() == '|') {
+      pos_++;
+      fragment g = concatenation();
+      int s = make(), e = make();
+      link(s, f.start_);
+      link(s, g.start_);
+      link(f.end_, e);
+      link(g.end_, e);
+      f = {s, e};
+    }
+    return f;
+  }
+
+  constexpr fragment concatenation() {
+    int s = make();
+    fragment f{s, s};
+    while (more() && peek() != '|' && peek() != ')') {
+      fragment g = repetition();
+      link(f.end_, g.start_);
+      f.end_ = g.end_;
+    }
+    return f;
+  }
+
+  constexpr fragment repetition() {
+    fragment f = atom();
+    while (more() && (peek() == '*' || peek() == '+' || peek() == '?')) {
+      char op = pattern_[pos_++];
+      int s = make(), e = make();
+      link(s, f.start_);
+      if (op != '+')
+        link(s, e);
+      if (op != '?')
+        link(f.end_, f.start_);
+      link(f.end_, e);
+      f = {s, e};
+    }
+    return f;
+  }
+
+  constexpr fragment atom() {
+    byte_set chars;
+    switch (char c = pattern_[pos_++]) {
+    case '(': {
+      fragment f = alternation();
+      if (!more() || pattern_[pos_++] != ')')
+        error("missing ')'");
+      return f;
+    }
+    case '*':
+    case '+':
+    case '?':
+      error("nothing to repeat");
+    case '.':
+      chars.flip();
+      chars.words_[0] &= ~(std::uint64_t(1) << '\n');
+      break;
+    case '[':
+      chars = char_class();
+      break;
+    case '\\':
+      chars = escape();
+      break;
+    default:
+      chars.set(std::uint8_t(c));
+    }
+    int s = make(), e = make();
+    at(s).chars_ = chars;
+    at(s).out_ = e;
+    return {s, e};
+  }
+
+  constexpr byte_set escape() {
+    if (!more())
+      error("trailing '\\'");
+    byte_set chars;
+    auto range = [&](char lo, char hi) {
+      for (int c = lo; c <= hi; c++)
+        chars.set(std::size_t(c));
+    };
+    switch (char c = pattern_[pos_++]) {
+    case 'd':
+      range('0', '9');
+      break;
+    case 'w':
+      range('0', '9');
+      range('a', 'z');
+      range('A', 'Z');
+      chars.set('_');
+      break;
+    case 's':
+      for (char s : {' ', '\t', '\n', '\r', '\f', '\v'})
+        chars.set(std::size_t(s));
+      break;
+    case 'n':
+      chars.set('\n');
+      break;
+    case 't':
+      chars.set('\t');
+      break;
+    case 'r':
+      chars.set('\r');
+      break;
+    default:
+      chars.set(std::uint8_t(c));
+    }
+    return chars;
+  }
+
+  constexpr byte_set char_class() {
+    byte_set chars;
+    bool negate = more() && peek() == '^';
+    pos_ += negate;
+    for (bool first = true; more() && (first || peek() != ']'); first = false) {
+      if (peek() == '\\') {
+        pos_++;
+        byte_set e = escape();
+        for (std::size_t i = 0; i < chars.words_.size(); i++)
+          chars.words_[i] |= e.words_[i];
+        continue;
+      }
+      auto lo = std::uint8_t(pattern_[pos_++]);
+      auto hi = lo;
+      if (pos_ + 1 < pattern_.size() && peek() == '-' &&
+          pattern_[pos_ + 1] != ']') {
+        hi = std::uint8_t(pattern_[pos_ + 1]);
+        pos_ += 2;
+      }
+      for (unsigned c = lo; c <= hi; c++)
+        chars.set(c);
+    }
+    if (!more())
+      error("missing ']'");
+    pos_++;
+    if (negate)
+      chars.flip();
+    return chars;
+  }
+
+  std::array<state, MaxNfa> states_{};
+  std::size_t size_ = 0;
+  std::string_view pattern_;
+  std::size_t pos_ = 0;
+};
+
+// Tablice leksera. Stan 0 to stan martwy, 1 - początkowy.
+template <std::size_t N, std::size_t MaxDfa, std::size_t MaxClasses>
+struct dfa {
+  static constexpr std::uint8_t dead = 0;
+  static constexpr std::uint8_t start = 1;
+
+  std::array<token_spec, N> specs_{};
+  std::array<std::uint8_t, 256> class_{};
+  std::array<std::array<std::uint8_t, MaxClasses>, MaxDfa> next_{};
+  std::array<std::int16_t, MaxDfa> accept_{};
+  std::size_t states_ = 0;
+  std::size_t classes_ = 0;
+};
+
+template <std::size_t N, std::size_t MaxNfa = 256, std::size_t MaxDfa = 128,
+          std::size_t MaxClasses = 64>
+constexpr dfa<N, MaxDfa, MaxClasses>
+build(const std::array<token_spec, N> &specs) {
+  static_assert(MaxDfa <= 256, "DFA states are stored in one byte");
+  using states = bit_set<MaxNfa>;
+  dfa<N, MaxDfa, MaxClasses> d;
+  d.specs_ = specs;
+
+  nfa<MaxNfa> a;
+  states initial;
+  for (std::size_t i = 0; i < N; i++)
+    initial.set(std::size_t(a.add(specs[i].pattern_, int(i)).start_));
+
+  // Klasy bajtów: bajty przechodzące do tych samych stanów są nieodróżnialne.
+  // Podział zaczyna się od jednej klasy i jest dzielony zbiorem bajtów każdego
+  // stanu z przejściem.
+  d.classes_ = 1;
+  for (std::size_t s = 0; s < a.size(); s++) {
+    if (a[s].out_ < 0)
+      continue;
+    std::array<int, 2 * MaxClasses> renumber{};
+    std::ranges::fill(renumber, -1);
+    std::size_t count = 0;
+    for (unsigned c = 0; c < 256; c++) {
+      auto &k = renumber[2 * d.class_[c] + a[s].chars_.test(c)];
+      if (k < 0)
+        k = int(count++);
+      d.class_[c] = std::uint8_t(k);
+    }
+    if (count > MaxClasses)
+      throw std::length_error("lexer: too many byte classes");
+    d.classes_ = count;
+  }
+  std::array<std::uint8_t, MaxClasses> representative{};
+  for (unsigned c = 256; c-- > 0;)
+    representative[d.class_[c]] = std::uint8_t(c);
+
+  // Domyka zbiór set przejściami pustymi; stack zawiera jego stany.
+  std::array<int, MaxNfa> stack;
+  auto closure = [&](states &set, std::size_t top) {
+    while (top > 0)
+      for (int e : a[std::size_t(stack[--top])].eps_)
+        if (e >= 0 && !set.test(std::size_t(e))) {
+          set.set(std::size_t(e));
+          stack[top++] = e;
+        }
+  };
+
+  // Konstrukcja podzbiorów.
+  std::array<states, MaxDfa> sets{};
+  std::size_t top = 0;
+  for (std::size_t s = 0; s < a.size(); s++)
+    if (initial.test(s))
+      stack[top++] = int(s);
+  closure(initial, top);
+  sets[dfa<N, MaxDfa, MaxClasses>::start] = initial;
+  // Skróty zbiorów oszczędzają porównań całych zbiorów, co ma znaczenie
+  // przy limicie operacji obliczeń constexpr.
+  auto hash = [](const states &set) {
+    std::uint64_t h = 0;
+    for (auto w : set.words_)
+      h = h * 0x9e3779b97f4a7c15ull + w;
+    return h;
+  };
+  std::array<std::uint64_t, MaxDfa> hashes{};
+  hashes[dfa<N, MaxDfa, MaxClasses>::start] = hash(initial);
+  d.states_ = 2;
+  std::array<std::size_t, MaxNfa> active;
+  for (std::size_t i = 1; i < d.states_; i++) {
+    d.accept_[i] = -1;
+    std::size_t count = 0;
+    for (std::size_t s = 0; s < a.size(); s++) {
+      if (!sets[i].test(s))
+        continue;
+      if (a[s].out_ >= 0)
+        active[count++] = s;
+      if (a[s].accept_ >= 0 &&
+          (d.accept_[i] < 0 || a[s].accept_ < d.accept_[i]))
+        d.accept_[i] = std::int16_t(a[s].accept_);
+    }
+
+    for (std::size_t k = 0; k < d.classes_; k++) {
+      states moved;
+      top = 0;
+      for (std::size_t n = 0; n < count; n++) {
+        auto &s = a[active[n]];
+        if (s.chars_.test(representative[k]) &&
+            !moved.test(std::size_t(s.out_))) {
+          moved.set(std::size_t(s.out_));
+          stack[top++] = s.out_;
+        }
+      }
+      if (top == 0)
+        continue; // Stan martwy.
+      closure(moved, top);
+      std::uint64_t h = hash(moved);
+      std::size_t j = 1;
+      while (j < d.states_ && (hashes[j] != h || !(sets[j] == moved)))
+        j++;
+      if (j == d.states_) {
+        if (j == MaxDfa)
+          throw std::length_error("lexer: too many DFA states");
+        hashes[j] = h;
+        sets[d.states_++] = moved;
+      }
+      d.next_[i][k] = std::uint8_t(j);
+    }
+  }
+  d.accept_[0] = -1;
+  return d;
+}
+
+// Wydaje tokeny bufora input, który musi istnieć, dopóki istnieje generator.
+template <std::size_t N, std::size_t MaxDfa, std::size_t MaxClasses>
+p3::Generator<token> lex(const dfa<N, MaxDfa, MaxClasses> &d,
+                         std::string_view input) {
+  using table = dfa<N, MaxDfa, MaxClasses>;
+  for (std::size_t pos = 0; pos < input.size();) {
+    std::uint8_t state = table::start;
+    int kind = -1;
+    std::size_t end = pos;
+    for (std::size_t i = pos; i < input.size(); i++) {
+      state = d.next_[state][d.class_[std::uint8_t(input[i])]];
+      if (state == table::dead)
+        break;
+      if (d.accept_[state] >= 0) {
+        kind = d.accept_[state];
+        end = i + 1;
+      }
+    }
+    if (kind < 0)
+      throw std::runtime_error("lexer: unexpected character at offset " +
+                               std::to_string(pos));
+    if (!d.specs_[std::size_t(kind)].skip_)
+      co_yield token{std::size_t(kind), input.substr(pos, end - pos)};
+    pos = end;
+  }
+}
+
+// Tokeny prostego języka konfiguracji.
+inline constexpr std::array<token_spec, 7> config_tokens = {{
+    {"space", R"([ \t\r\n]+)", true},
+    {"comment", R"(#[^\n]*)", true},
+    {"keyword", R"(let|fn|if|else|return)"},
+    {"identifier", R"([A-Za-z_]\w*)"},
+    {"number", R"(\d+(\.\d+)?([eE][+\-]?\d+)?)"},
+    {"string", R"("([^"\\]|\\.)*")"},
+    {"operator", R"(==|!=|<=|>=|&&|\|\||[-+*/=<>!(){},;])"},
+}};
+
+inline constexpr auto config_lexer = build(config_tokens);
+static_assert(config_lexer.states_ > 2, "DFA is built at compile time");
+
+auto main() -> void {
+  std::cout << "main: " << config_lexer.states_ << " DFA states, "
+            << config_lexer.classes_ << " byte classes" << std::endl;
+
+  const std::string_view program = R"(# ustawienia
+let letter = "a \"quoted\" value";
+fn scale(x) { if x >= 1.5e3 { return x * 2; } else { return x; } })";
+  for (auto t : lex(config_lexer, program))
+    std::cout << config_lexer.specs_[t.kind_].name_ << " '" << t.text_ << "'"
+              << std::endl;
+
+  std::string big;
+  for (std::size_t i = 0; i < 100000; i++)
+    big.append(program).append("\n");
+  auto start = std::chrono::steady_clock::now();
+  std::size_t tokens = 0;
+  for (auto t : lex(config_lexer, big)) {
+    (void)t;
+    tokens++;
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "main: " << tokens << " tokens, "
+            << double(big.size()) / elapsed.count() / 1e6 << " MB/s"
+            << std::endl;
+}
+} // namespace p28
+
 auto main() -> int {
   std::cout << "<--- p1 --->" << std::endl;
   p1::main();
@@ -364,6 +6890,56 @@ auto main() -> int {
   p2::main();
   std::cout << "<--- p3 --->" << std::endl;
   p3::main();
+  std::cout << "<--- p4 --->" << std::endl;
+  p4::main();
+  std::cout << "<--- p5 --->" << std::endl;
+  p5::main();
+  std::cout << "<--- p6 --->" << std::endl;
+  p6::main();
+  std::cout << "<--- p7 --->" << std::endl;
+  p7::main();
+  std::cout << "<--- p8 --->" << std::endl;
+  p8::main();
+  std::cout << "<--- p9 --->" << std::endl;
+  p9::main();
+  std::cout << "<--- p10 --->" << std::endl;
+  p10::main();
+  std::cout << "<--- p11 --->" << std::endl;
+  p11::main();
+  std::cout << "<--- p12 --->" << std::endl;
+  p12::main();
+  std::cout << "<--- p13 --->" << std::endl;
+  p13::main();
+  std::cout << "<--- p14 --->" << std::endl;
+  p14::main();
+  std::cout << "<--- p15 --->" << std::endl;
+  p15::main();
+  std::cout << "<--- p16 --->" << std::endl;
+  p16::main();
+  std::cout << "<--- p17 --->" << std::endl;
+  p17::main();
+  std::cout << "<--- p18 --->" << std::endl;
+  p18::main();
+  std::cout << "<--- p19 --->" << std::endl;
+  p19::main();
+  std::cout << "<--- p20 --->" << std::endl;
+  p20::main();
+  std::cout << "<--- p21 --->" << std::endl;
+  p21::main();
+  std::cout << "<--- p22 --->" << std::endl;
+  p22::main();
+  std::cout << "<--- p23 --->" << std::endl;
+  p23::main();
+  std::cout << "<--- p24 --->" << std::endl;
+  p24::main();
+  std::cout << "<--- p25 --->" << std::endl;
+  p25::main();
+  std::cout << "<--- p26 --->" << std::endl;
+  p26::main();
+  std::cout << "<--- p27 --->" << std::endl;
+  p27::main();
+  std::cout << "<--- p28 --->" << std::endl;
+  p28::main();
   return 0;
 }
 